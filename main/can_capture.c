@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "can_manager.h"
+#include "can_capture.h"
+#include "task_config.h"
+
+static const char *TAG = "CAN_CAP";
+
+#define CAPTURE_RING_MASK (CAPTURE_RING_LEN - 1)
+#define CAPTURE_RX_QUEUE_LEN 64
+#define BUS_POLL_DELAY 100 // ms between bus claim attempts
+
+// Single-producer single-consumer ring. Only the task that owns the TWAI driver
+// pushes (bus ownership is exclusive), and readers serialize on pop_lock.
+static capture_frame_t *ring = NULL;
+static uint32_t ring_head = 0; // Written by the producer only
+static uint32_t ring_tail = 0; // Written by the consumer only
+static SemaphoreHandle_t pop_lock = NULL;
+
+static volatile bool capture_active = false;
+static uint32_t filter_ids[CAPTURE_MAX_FILTERS];
+static size_t filter_count = 0;
+static TaskHandle_t capture_task_handle = NULL;
+static capture_stats_t stats;
+
+// Bus handoff: a claimant waits on `handoff` while the capture task stops its driver
+static portMUX_TYPE yield_lock = portMUX_INITIALIZER_UNLOCKED;
+static volatile bool owns_bus = false;
+static volatile bool yield_requested = false;
+static SemaphoreHandle_t handoff = NULL;
+
+// --- RING ---
+
+CAN_HOT_ATTR void can_capture_push(const twai_message_t *msg) {
+    if (!capture_active) return;
+
+    if (filter_count) {
+        bool match = false;
+        for (size_t i = 0; i < filter_count && !match; i++) match = (msg->identifier == filter_ids[i]);
+        if (!match) {
+            stats.filtered++;
+            return;
+        }
+    }
+
+    uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE);
+    if (head - tail >= CAPTURE_RING_LEN) {
+        stats.dropped++;
+        return;
+    }
+
+    capture_frame_t *slot = &ring[head & CAPTURE_RING_MASK];
+    slot->timestamp_us = esp_timer_get_time();
+    slot->msg = *msg;
+    __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+    stats.captured++;
+}
+
+bool can_capture_pop(capture_frame_t *out) {
+    bool got = false;
+    if (!ring) return false;
+
+    xSemaphoreTake(pop_lock, portMAX_DELAY);
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+        *out = ring[tail & CAPTURE_RING_MASK];
+        __atomic_store_n(&ring_tail, tail + 1, __ATOMIC_RELEASE);
+        got = true;
+    }
+    xSemaphoreGive(pop_lock);
+    return got;
+}
+
+int can_capture_format(const capture_frame_t *frame, char *buf, size_t len) {
+    const twai_message_t *m = &frame->msg;
+    int n = snprintf(buf, len, m->extd ? "(%lld.%06lld) can0 %08lX#" : "(%lld.%06lld) can0 %03lX#",
+                     frame->timestamp_us / 1000000, frame->timestamp_us % 1000000, m->identifier);
+    if (m->rtr) {
+        n += snprintf(buf + n, len - n, "R");
+    } else {
+        for (int i = 0; i < m->data_length_code && i < 8; i++) n += snprintf(buf + n, len - n, "%02X", m->data[i]);
+    }
+    n += snprintf(buf + n, len - n, "\n");
+    return n;
+}
+
+// --- CAPTURE TASK ---
+// Owns the bus while no transfer is running
+
+// Stops the driver and passes the bus to a waiting claimant, or frees it
+static void release_bus(void) {
+    twai_status_info_t info;
+    if (twai_get_status_info(&info) == ESP_OK) {
+        stats.rx_missed += info.rx_missed_count;
+        stats.rx_overrun += info.rx_overrun_count;
+    }
+    twai_stop();
+    twai_driver_uninstall();
+
+    portENTER_CRITICAL(&yield_lock);
+    owns_bus = false;
+    bool hand_over = yield_requested;
+    yield_requested = false;
+    portEXIT_CRITICAL(&yield_lock);
+
+    // SYSTEM_IS_BUSY stays set for the claimant
+    if (hand_over) xSemaphoreGive(handoff);
+    else ota_release_bus();
+}
+
+static void capture_task(void *arg) {
+    while (capture_active) {
+        if (!owns_bus) {
+            if (!ota_claim_bus()) {
+                vTaskDelay(pdMS_TO_TICKS(BUS_POLL_DELAY));
+                continue;
+            }
+            // Normal mode so the gateway ACKs exactly as it does while flashing
+            twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_GPIO_TX, CAN_GPIO_RX, TWAI_MODE_NORMAL);
+            g_config.rx_queue_len = CAPTURE_RX_QUEUE_LEN;
+            twai_timing_config_t t_config = TWAI_TIMING_CONFIG_250KBITS();
+            twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+            if (twai_driver_install(&g_config, &t_config, &f_config) != ESP_OK || twai_start() != ESP_OK) {
+                ESP_LOGE(TAG, "Failed to start driver");
+                twai_driver_uninstall();
+                ota_release_bus();
+                vTaskDelay(pdMS_TO_TICKS(BUS_POLL_DELAY));
+                continue;
+            }
+            owns_bus = true;
+        }
+
+        if (yield_requested) {
+            // Capture resumes once the transfer or job releases the bus
+            release_bus();
+            continue;
+        }
+
+        twai_message_t msg;
+        if (twai_receive(&msg, pdMS_TO_TICKS(50)) == ESP_OK) can_capture_push(&msg);
+    }
+
+    if (owns_bus) release_bus();
+    capture_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
+// --- PUBLIC API ---
+
+esp_err_t can_capture_start(const uint32_t *ids, size_t id_count) {
+    if (capture_active) return ESP_ERR_INVALID_STATE;
+    if (id_count > CAPTURE_MAX_FILTERS) return ESP_ERR_INVALID_ARG;
+    // The previous capture task may still be releasing the driver
+    if (capture_task_handle) return ESP_ERR_INVALID_STATE;
+
+    if (!pop_lock) pop_lock = xSemaphoreCreateMutex();
+    if (!handoff) handoff = xSemaphoreCreateBinary();
+    if (!ring) ring = malloc(CAPTURE_RING_LEN * sizeof(capture_frame_t));
+    if (!ring || !pop_lock || !handoff) return ESP_ERR_NO_MEM;
+
+    ring_head = ring_tail = 0;
+    memset(&stats, 0, sizeof(stats));
+    filter_count = id_count;
+    if (id_count) memcpy(filter_ids, ids, id_count * sizeof(uint32_t));
+
+    capture_active = true;
+    BaseType_t res = xTaskCreatePinnedToCore(capture_task, "can_capture", CAPTURE_TASK_STACK, NULL, CAPTURE_TASK_PRIORITY, &capture_task_handle, CAN_TASK_CORE);
+    if (res != pdPASS) {
+        capture_active = false;
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Capture started (%d ID filters)", id_count);
+    return ESP_OK;
+}
+
+void can_capture_stop(void) {
+    if (!capture_active) return;
+    capture_active = false;
+    ESP_LOGI(TAG, "Capture stopped: %ld frames, %ld dropped", stats.captured, stats.dropped);
+}
+
+bool can_capture_yield(void) {
+    portENTER_CRITICAL(&yield_lock);
+    bool wait = owns_bus && !yield_requested;
+    if (wait) yield_requested = true;
+    portEXIT_CRITICAL(&yield_lock);
+    if (!wait) return false;
+
+    // The capture task checks the request at least every receive timeout
+    xSemaphoreTake(handoff, portMAX_DELAY);
+    ESP_LOGI(TAG, "Bus handed over, capture continues from the transfer");
+    return true;
+}
+
+bool can_capture_active(void) {
+    return capture_active;
+}
+
+void can_capture_get_stats(capture_stats_t *out) {
+    *out = stats;
+    out->active = capture_active;
+}
@@ -0,0 +1,148 @@
+#include <string.h>
+#include "can_codec.h"
+#include "task_config.h"
+
+// --- ENCODER TABLES ---
+
+#define COMMAND_FRAME(name, id, b0, b1) \
+    [name] = { .extd = 1, .identifier = (id), .data_length_code = 8, .data = { (b0), (b1) } },
+
+static const twai_message_t command_frames[CAN_COMMAND_COUNT] = {
+    CAN_COMMANDS(COMMAND_FRAME)
+};
+
+// --- DECODER TABLES ---
+// Indexed by data[0] and by the byte sum. Unlisted slots are 0 = BMS_NONE.
+
+#define MARKER_SLOT(name, key) [(key)] = (name),
+#define SUM_SLOT(name, key) [(key)] = (name),
+#define NO_SLOT(name, key)
+
+static const CAN_HOT_DATA uint8_t marker_table[256] = {
+    BMS_RESPONSES(MARKER_SLOT, NO_SLOT)
+};
+
+static const CAN_HOT_DATA uint8_t sum_table[BMS_RESPONSE_MAX_SUM + 1] = {
+    BMS_RESPONSES(NO_SLOT, SUM_SLOT)
+};
+
+// --- RESPONSE ENCODINGS (first key of each kind) ---
+
+typedef struct {
+    bool marker;
+    uint16_t key;
+} response_key_t;
+
+#define MARKER_KEY(name, key) if (kind == (name)) return (response_key_t){ true, (key) };
+#define SUM_KEY(name, key) if (kind == (name)) return (response_key_t){ false, (key) };
+
+static response_key_t response_key(bms_response_t kind) {
+    BMS_RESPONSES(MARKER_KEY, SUM_KEY)
+    return (response_key_t){ false, 0 };
+}
+
+// --- PUBLIC API ---
+
+CAN_HOT_ATTR uint16_t calcrc(uint8_t *ptr, int count) {
+    uint16_t crc = 0;
+    while (--count >= 0) {
+        crc = crc ^ (int) * ptr++ << 8;
+        for (int i = 0; i < 8; i++) {
+            if (crc & 0x8000) crc = (crc << 1) ^ 0x1021;
+            else crc = crc << 1;
+        }
+    }
+    return (crc);
+}
+
+void can_encode_command(can_command_t cmd, twai_message_t *out) {
+    *out = command_frames[cmd];
+}
+
+void can_encode_size(uint32_t stream_len, uint8_t encoding, uint32_t image_len, uint8_t framing, uint8_t burst_frames,
+                     twai_message_t *out) {
+    *out = (twai_message_t){ .extd = 1, .identifier = ID_SIZE, .data_length_code = 8, .data = {
+        stream_len & 0xFF, (stream_len >> 8) & 0xFF } };
+    // Byte-identical to the original size frame
+    if (encoding == DATA_ENCODING_RAW && framing == DATA_FRAMING_LEGACY) return;
+    out->data[2] = encoding;
+    out->data[3] = image_len & 0xFF;
+    out->data[4] = (image_len >> 8) & 0xFF;
+    out->data[5] = (image_len >> 16) & 0xFF;
+    out->data[6] = framing;
+    out->data[7] = framing == DATA_FRAMING_FULL ? burst_frames : 0;
+}
+
+CAN_HOT_ATTR void can_encode_data(const uint8_t *payload, size_t len, twai_message_t *out) {
+    if (len > FRAME_PAYLOAD) len = FRAME_PAYLOAD;
+    *out = (twai_message_t){ .extd = 1, .identifier = ID_DATA, .data_length_code = 8 };
+    memset(out->data, 0xFF, FRAME_PAYLOAD);
+    memcpy(out->data, payload, len);
+
+    uint16_t crc = calcrc(out->data, FRAME_PAYLOAD);
+    out->data[6] = crc & 0xFF;
+    out->data[7] = crc >> 8;
+}
+
+CAN_HOT_ATTR void can_encode_data_full(const uint8_t *payload, size_t len, twai_message_t *out) {
+    if (len > FRAME_PAYLOAD_FULL) len = FRAME_PAYLOAD_FULL;
+    *out = (twai_message_t){ .extd = 1, .identifier = ID_DATA, .data_length_code = 8 };
+    memset(out->data, 0xFF, FRAME_PAYLOAD_FULL);
+    memcpy(out->data, payload, len);
+}
+
+void can_encode_burst_crc(uint16_t crc, uint8_t frames, twai_message_t *out) {
+    *out = (twai_message_t){ .extd = 1, .identifier = ID_BURST_CRC, .data_length_code = 8, .data = {
+        crc & 0xFF, crc >> 8, frames } };
+}
+
+void can_encode_verify(uint32_t image_crc32, uint32_t image_len, twai_message_t *out) {
+    *out = (twai_message_t){ .extd = 1, .identifier = ID_VERIFY, .data_length_code = 8, .data = {
+        image_crc32 & 0xFF, (image_crc32 >> 8) & 0xFF, (image_crc32 >> 16) & 0xFF, image_crc32 >> 24,
+        image_len & 0xFF, (image_len >> 8) & 0xFF, (image_len >> 16) & 0xFF, 0 } };
+}
+
+void can_encode_fill(uint32_t offset, uint32_t len, uint8_t value, twai_message_t *out) {
+    *out = (twai_message_t){ .extd = 1, .identifier = ID_FILL, .data_length_code = 8, .data = {
+        offset & 0xFF, (offset >> 8) & 0xFF, (offset >> 16) & 0xFF,
+        len & 0xFF, (len >> 8) & 0xFF, (len >> 16) & 0xFF, value } };
+    out->data[7] = calcrc(out->data, 7) & 0xFF;
+}
+
+bool can_decode_fill(const twai_message_t *msg, uint32_t *offset, uint32_t *len, uint8_t *value) {
+    uint8_t d[7];
+    memcpy(d, msg->data, sizeof(d));
+    if ((calcrc(d, sizeof(d)) & 0xFF) != msg->data[7]) return false;
+    *offset = d[0] | (d[1] << 8) | ((uint32_t)d[2] << 16);
+    *len = d[3] | (d[4] << 8) | ((uint32_t)d[5] << 16);
+    *value = d[6];
+    return true;
+}
+
+can_command_t can_decode_command(const twai_message_t *msg) {
+    for (int i = 0; i < CAN_COMMAND_COUNT; i++) {
+        const twai_message_t *f = &command_frames[i];
+        if (msg->identifier == f->identifier && memcmp(msg->data, f->data, 8) == 0) return i;
+    }
+    return CAN_COMMAND_COUNT;
+}
+
+CAN_HOT_ATTR bms_response_t can_decode_response(const twai_message_t *msg) {
+    if (msg->identifier != ID_BMS_RESPONSE) return BMS_NONE;
+    const uint8_t *d = msg->data;
+    bms_response_t kind = marker_table[d[0]];
+    if (kind != BMS_NONE) return kind;
+    return sum_table[d[0] + d[1] + d[2] + d[3] + d[4] + d[5] + d[6] + d[7]];
+}
+
+void can_encode_response(bms_response_t kind, twai_message_t *out) {
+    response_key_t key = response_key(kind);
+    *out = (twai_message_t){ .extd = 1, .identifier = ID_BMS_RESPONSE, .data_length_code = 8 };
+    // Spread a sum over as few bytes as possible, starting at data[0]
+    for (int i = 0; i < 8 && key.key; i++) {
+        uint16_t b = key.key > 0xFF ? 0xFF : key.key;
+        out->data[i] = b;
+        key.key -= b;
+        if (key.marker) break;
+    }
+}
@@ -4,18 +4,37 @@
  */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/twai.h"
 #include "esp_log.h"
+#include "esp_crc.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 #include "app_shared.h"
+#include "can_manager.h"
+#include "can_protocol.h"
+#include "can_codec.h"
+#include "can_transport.h"
+#include "isotp.h"
+#include "sim_bms.h"
+#include "uds_client.h"
+#include "ota_status.h"
+#include "can_capture.h"
+#include "frame_jitter.h"
+#include "transfer_plan.h"
+#include "lzss.h"
+#include "sparse_image.h"
+#include "flash_geometry.h"
+#include "session_arena.h"
+#include "task_config.h"
 
 static const char *TAG = "CAN_OTA";
 
-// --- CONFIGURATION ---
-#define GPIO_RX 35
-#define GPIO_TX 32
+static portMUX_TYPE busy_lock = portMUX_INITIALIZER_UNLOCKED;
 
 // --- STATUS DEFINITIONS ---
 #define UPDATE_ONGOING 0x01
@@ -25,18 +44,97 @@ static const char *TAG = "CAN_OTA";
 #define HANDSHAKE_INIT 0x11
 #define REQUEST_RECIEVE_MSG 0X04
 #define COMPLETE_RECIEVE_MSG 0X05
+#define NACK_RECIEVE_MSG 0x15
+#define BUS_FAULT 0xF0 // Not a BMS message: the supervisor recovered the bus, resync needed
+
+// --- IMAGE VERIFICATION ---
+#define VERIFY_TIMEOUT 2000
+// Otherwise only a BMS that offers BMS_CAP_VERIFY_CRC is asked for the image CRC
+#if CONFIG_BMS_OTA_VERIFY_IMAGE_CRC
+#define VERIFY_ALWAYS true
+#else
+#define VERIFY_ALWAYS false
+#endif
 
-#define INIT_DELAY 5000
-#define START_DELAY 500
 #define MS_DELAY 2 
 #define CAN_SEND_DELAY (MS_DELAY/10)*5
 #define CAN_RECIEVE_DELAY (MS_DELAY/10)*5
 
+#define EWMA_WEIGHT 0.125f // Weight of the newest sample in the telemetry averages
+#define FRAME_RETRY_LIMIT 5
+
+// --- ERROR SUPERVISOR ---
+#define BUS_RECOVERY_TIMEOUT 5000 // Bus-off recovery needs 128 x 11 recessive bits, allow for a flaky harness
+#define RESPONSE_TIMEOUT 3000     // No expected BMS reply for this long -> resync
+#define SESSION_START_TIMEOUT 30000 // No handshake from the BMS at all
+#define RESYNC_LIMIT 5
+
 // --- GLOBAL FLAGS (Internal to CAN) ---
 bool OTA_update_flag = false;
 bool flash_write_status = false;
 uint16_t flash_write_counter = 0;
-uint16_t byte_count = 0; // Tracks position in firmware_buffer
+uint32_t byte_count = 0; // Tracks position in ota_image
+
+// --- TRANSPORT ---
+// Set per session: real BMS, loopback self-test or simulated BMS
+const can_transport_t *transport = NULL;
+
+// --- IMAGE BEING FLASHED ---
+// Set per session, so a queued job can be flashed while firmware_buffer is replaced
+const uint8_t *ota_image = NULL;
+size_t ota_image_len = 0;
+uint32_t image_crc32 = 0; // Running CRC-32 of the image bytes sent so far
+
+// --- DATA ENCODING ---
+// With an encoding, ota_image is the encoded stream; the BMS verifies the decoded image
+uint8_t data_encoding = DATA_ENCODING_RAW;
+size_t plain_len = 0;
+uint32_t plain_crc32 = 0;
+
+// --- DATA FRAMING ---
+// Legacy until the BMS offers full frames during the handshake
+uint8_t bms_caps = 0;
+uint8_t bms_caps_burst = 0;
+uint8_t data_framing = DATA_FRAMING_LEGACY;
+uint8_t frame_payload = FRAME_PAYLOAD;
+uint8_t burst_frames = BURST_FRAMES;
+
+// Constant-byte runs of a DATA_ENCODING_SPARSE stream, sent as fill frames
+fill_run_t *fill_runs = NULL;
+size_t fill_run_count = 0;
+
+// Stream offsets where BMS flash pages end. With full framing no burst crosses one.
+uint32_t *page_ends = NULL;
+size_t page_count = 0;
+
+bool transfer_aborted = false;
+uint32_t ota_sent_bytes = 0;
+
+// Working copy of the published status, only touched by the CAN task
+ota_status_t live_status = { .busy = false, .state = OTA_STATE_IDLE };
+
+// --- TELEMETRY ---
+int64_t burst_start_us = 0;
+int64_t last_burst_end_us = 0;
+int64_t flash_pause_start_us = 0;
+int64_t last_frame_us = 0;
+int64_t session_start_us = 0;
+int64_t data_start_us = 0;
+float goodput_avg = 0;
+float frame_rate_avg = 0;
+float burst_rtt_avg = 0;
+float flash_pause_avg = 0;
+
+// --- RETRANSMIT WINDOW ---
+uint32_t window_start = 0; // byte_count of the first frame in the current burst
+uint32_t acked_offset = 0; // byte_count the BMS last confirmed with a complete message
+uint32_t acked_crc32 = 0;  // image_crc32 at acked_offset
+uint8_t resync_count = 0;  // Consecutive resyncs without progress
+bool bus_fault = false;    // Bus went off and was recovered, window must be resent
+uint8_t window_frames = 0;
+uint8_t frame_retries[MAX_BURST_FRAMES];
+uint8_t nack_frame_index = 0;
+uint32_t window_fill_len = 0; // Non-zero if the window is one fill frame of this many bytes
 
 // --- TWAI VARIABLES ---
 twai_message_t tx_msg;
@@ -54,96 +152,130 @@ typedef enum {
 
 // --- HELPER FUNCTIONS ---
 
-uint16_t calcrc(uint8_t *ptr, int count) {
-    uint16_t crc = 0;
-    while (--count >= 0) {
-        crc = crc ^ (int) * ptr++ << 8;
-        for (int i = 0; i < 8; i++) {
-            if (crc & 0x8000) crc = (crc << 1) ^ 0x1021;
-            else crc = crc << 1;
-        }
-    }
-    return (crc);
+static float ewma(float avg, float sample) {
+    return (avg == 0) ? sample : avg + EWMA_WEIGHT * (sample - avg);
 }
 
-void initialize_twai(void) {
-    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(GPIO_TX, GPIO_RX, TWAI_MODE_NORMAL);
-    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_250KBITS();
-    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
-
-    // Install TWAI driver
-    if (twai_driver_install(&g_config, &t_config, &f_config) == ESP_OK) {
-        ESP_LOGI(TAG, "Driver installed");
-    } else {
-        ESP_LOGE(TAG, "Failed to install driver");
-        return;
-    }
-    // Start TWAI driver
-    if (twai_start() == ESP_OK) {   
-        ESP_LOGI(TAG, "Driver started");
-    } else {
-        ESP_LOGE(TAG, "Failed to start driver");
-        return;
-    }
+// Copies progress into the working status and publishes it to httpd readers.
+// Lock-free, so it is cheap enough to call once per burst.
+void publish_status(ota_state_t state, ota_error_t error) {
+    live_status.state = state;
+    live_status.error = error;
+    live_status.sent = ota_sent_bytes;
+    live_status.retries = ota_metrics.retries;
+    live_status.retransmit_bytes = ota_metrics.retransmit_bytes;
+    live_status.goodput_bps = goodput_avg;
+    live_status.frame_rate = frame_rate_avg;
+    live_status.burst_rtt_us = burst_rtt_avg;
+    live_status.flash_pause_us = flash_pause_avg;
+    live_status.eta_s = (goodput_avg > 0 && ota_sent_bytes < ota_image_len) ? (ota_image_len - ota_sent_bytes) / goodput_avg : 0;
+    ota_status_publish(&live_status);
 }
 
-void release_twai(void) {
-    twai_stop();
-    twai_driver_uninstall();
-    ESP_LOGI(TAG, "Driver Released");
+twai_filter_config_t can_filter_for_ids(const uint32_t *ids, size_t count) {
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+    if (count == 0) return f_config;
+
+    // Single filter, 29-bit layout: ID in bits 31..3, RTR in bit 2, mask bit 1 = don't care.
+    // Any ID bit that differs between the wanted IDs becomes don't care.
+    uint32_t differ = 0;
+    for (size_t i = 1; i < count; i++) differ |= ids[i] ^ ids[0];
+    f_config.acceptance_code = ids[0] << 3;
+    f_config.acceptance_mask = (differ << 3) | 0x7;
+    f_config.single_filter = true;
+    return f_config;
 }
 
-uint16_t switch_ota_status(int sum_val) {
-    uint16_t return_status = 0;
-    if(sum_val == 8){
-        OTA_update_flag = true;
-        return_status = UPDATE_ONGOING;
-    } 
-    else if (sum_val == 16){
-        OTA_update_flag = false;
-        return_status = STOP_UPDATE;   
-    }
-    else if (sum_val == 24 || sum_val == 48){
-        // CRITICAL: BMS is writing to flash, we must pause
-        flash_write_status = true;
-        return_status = UPDATE_ONGOING;
-    }
-    else if (sum_val == 32){
-        // BMS finished writing
-        flash_write_status = false;
-        return_status = UPDATE_ONGOING;
-        flash_write_counter++;
-    }
-    else if (sum_val == 0xFF){
-        return_status = HANDSHAKE_INIT;
-    }
-    else if (sum_val == 290){
-        return_status = START_UPDATE;
-    }
-    else if (sum_val == 0x88){
-        return_status = REQUEST_RECIEVE_MSG;
+// Reads pending TWAI alerts without blocking and counts each incident.
+// On bus-off it runs the recovery sequence and restarts the controller.
+// Returns true if the bus went off, so the caller must resync with the BMS.
+bool supervise_bus(void) {
+    uint32_t alerts = 0;
+    if (transport->read_alerts(&alerts, 0) != ESP_OK) return false;
+
+    if (alerts & TWAI_ALERT_ERR_PASS) {
+        ESP_LOGW(TAG, "Controller error passive");
+        ota_metrics.err_passive++;
     }
-    else if (sum_val == 0x90){
-        return_status = COMPLETE_RECIEVE_MSG;
+    if (alerts & TWAI_ALERT_RX_QUEUE_FULL) ota_metrics.rx_queue_full++;
+    if (alerts & TWAI_ALERT_ARB_LOST) ota_metrics.arb_lost++;
+    if (!(alerts & TWAI_ALERT_BUS_OFF)) return false;
+
+    ESP_LOGE(TAG, "Bus-off, starting recovery");
+    ota_metrics.bus_off++;
+    bus_fault = true;
+    if (transport->recover(pdMS_TO_TICKS(BUS_RECOVERY_TIMEOUT)) == ESP_OK) {
+        ESP_LOGW(TAG, "Bus recovered");
+        ota_metrics.bus_recoveries++;
+        return true;
     }
-    else{
-        return_status = NO_UPDATE;
+    ESP_LOGE(TAG, "Bus did not recover");
+    transfer_aborted = true;
+    publish_status(OTA_STATE_FAILED, OTA_ERR_BUS_OFF);
+    return true;
+}
+
+// Maps a decoded BMS response to the engine's status and tracks flash pauses.
+// A switch over a dense enum compiles to a jump table.
+CAN_HOT_ATTR uint16_t switch_ota_status(bms_response_t response) {
+    switch (response) {
+        case BMS_UPDATE_ONGOING:
+            OTA_update_flag = true;
+            return UPDATE_ONGOING;
+        case BMS_STOP_UPDATE:
+            OTA_update_flag = false;
+            return STOP_UPDATE;
+        case BMS_FLASH_BUSY:
+            // CRITICAL: BMS is writing to flash, we must pause
+            ota_metrics.flash_busy++;
+            if (!flash_write_status) {
+                flash_pause_start_us = esp_timer_get_time();
+                live_status.phase = OTA_PHASE_FLASH_PAUSE;
+            }
+            flash_write_status = true;
+            return UPDATE_ONGOING;
+        case BMS_FLASH_DONE:
+            // BMS finished writing
+            if (flash_write_status) {
+                int64_t pause_us = esp_timer_get_time() - flash_pause_start_us;
+                flash_pause_avg = ewma(flash_pause_avg, pause_us);
+                ota_metrics.flash_pauses++;
+                ota_metrics.flash_pause_ms += (pause_us + 500) / 1000;
+                live_status.phase = OTA_PHASE_WAIT_ACK;
+            }
+            flash_write_status = false;
+            flash_write_counter++;
+            return UPDATE_ONGOING;
+        case BMS_HANDSHAKE:
+            return HANDSHAKE_INIT;
+        case BMS_START:
+            return START_UPDATE;
+        case BMS_REQUEST:
+            return REQUEST_RECIEVE_MSG;
+        case BMS_COMPLETE:
+            return COMPLETE_RECIEVE_MSG;
+        case BMS_NACK:
+            nack_frame_index = rx_msg.data[1];
+            return NACK_RECIEVE_MSG;
+        case BMS_CAPS:
+            bms_caps = rx_msg.data[1];
+            bms_caps_burst = rx_msg.data[2];
+            return NO_UPDATE;
+        default:
+            return NO_UPDATE;
     }
-    return return_status;
 }
 
-uint16_t recieve_twai(void) {
+CAN_HOT_ATTR uint16_t recieve_twai(void) {
     uint16_t OTA_status = 0;
-    int sum = 0;
+
+    if (supervise_bus()) return BUS_FAULT;
     
-    twai_rx_state = twai_receive(&rx_msg, pdMS_TO_TICKS(CAN_RECIEVE_DELAY));
+    twai_rx_state = transport->recv(&rx_msg, pdMS_TO_TICKS(CAN_RECIEVE_DELAY));
     
     if (twai_rx_state == ESP_OK) {
-        if (rx_msg.identifier == 0x067B84) {
-            // ESP_LOGI(TAG, "RX Data: %X %X ...", rx_msg.data[0], rx_msg.data[1]);
-            sum = rx_msg.data[0] + rx_msg.data[1] + rx_msg.data[2] + rx_msg.data[3] + rx_msg.data[4] + rx_msg.data[5] + rx_msg.data[6] + rx_msg.data[7];
-            OTA_status = switch_ota_status(sum);
-        } 
+        can_capture_push(&rx_msg);
+        OTA_status = switch_ota_status(can_decode_response(&rx_msg));
     }
     else if(OTA_update_flag == true) {
         OTA_status = UPDATE_ONGOING;
@@ -157,83 +289,351 @@ uint16_t recieve_twai(void) {
 // --- SEND FUNCTIONS ---
 
 void send_start_handshake() {
-    tx_msg = (twai_message_t){ .extd = 1, .identifier = 0x017B84, .data_length_code = 8, .data = {0x01, 0, 0, 0, 0, 0, 0, 0} };
-    twai_transmit(&tx_msg, pdMS_TO_TICKS(100));
+    can_encode_command(CMD_START_HANDSHAKE, &tx_msg);
+    transport->send(&tx_msg, pdMS_TO_TICKS(100));
 }
 
 void send_reset_BMS() {
-    tx_msg = (twai_message_t){ .extd = 1, .identifier = 0x017B84, .data_length_code = 8, .data = {0x11, 0, 0, 0, 0, 0, 0, 0} };
-    twai_transmit(&tx_msg, pdMS_TO_TICKS(100));
+    can_encode_command(CMD_RESET_BMS, &tx_msg);
+    transport->send(&tx_msg, pdMS_TO_TICKS(100));
 }
 
 void send_start_cmd() {
-    vTaskDelay(pdMS_TO_TICKS(START_DELAY));
-    tx_msg = (twai_message_t){ .extd = 1, .identifier = 0x027B84, .data_length_code = 8, .data = {0x69, 0x32, 0, 0, 0, 0, 0, 0} };
-    twai_transmit(&tx_msg, pdMS_TO_TICKS(100));
+    can_encode_command(CMD_START, &tx_msg);
+    transport->send(&tx_msg, pdMS_TO_TICKS(100));
 }
 
 void send_size() {
-    uint8_t size_bytes[2];
-    size_bytes[0] = firmware_len & 0xFF;
-    size_bytes[1] = firmware_len >> 8;
-    tx_msg = (twai_message_t){ .extd = 1, .identifier = 0x037B84, .data_length_code = 8, .data = {size_bytes[0], size_bytes[1], 0, 0, 0, 0, 0, 0} };
-    twai_transmit(&tx_msg, pdMS_TO_TICKS(100));
+    can_encode_size(ota_image_len, data_encoding, plain_len, data_framing, burst_frames, &tx_msg);
+    transport->send(&tx_msg, pdMS_TO_TICKS(100));
+}
+
+// Opens a session: a BMS in its application or bootloader answers the handshake request
+void send_session_probe(void) {
+    send_start_cmd();
+    send_size();
+    send_start_handshake();
+}
+
+// Starts the data phase once the BMS has answered the reset; the BMS takes the size when it is ready
+void send_data_probe(void) {
+    send_start_cmd();
+    send_size();
+}
+
+// Sends `probe` now and every BMS_HANDSHAKE_PROBE_MS until the BMS answers
+// with `ready` (or already reports an update in progress). The old fixed
+// INIT_DELAY + START_DELAY is only the upper bound: at the bound the probe
+// goes out once more, as it did after the sleep, and NO_UPDATE is returned
+// so the caller keeps listening.
+uint16_t wait_bms_ready(void (*probe)(void), uint16_t ready) {
+    TickType_t start = xTaskGetTickCount();
+    TickType_t last_probe = start;
+    probe();
+    ota_metrics.handshake_probes++;
+
+    while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(INIT_DELAY + START_DELAY)) {
+        uint16_t status = recieve_twai();
+        if (status == ready || status == UPDATE_ONGOING) return status;
+        if (transfer_aborted) return NO_UPDATE;
+#if CONFIG_BMS_HANDSHAKE_PROBE_MS
+        if ((xTaskGetTickCount() - last_probe) >= pdMS_TO_TICKS(CONFIG_BMS_HANDSHAKE_PROBE_MS)) {
+            probe();
+            ota_metrics.handshake_probes++;
+            last_probe = xTaskGetTickCount();
+        }
+#endif
+        vTaskDelay(1);
+    }
+    ESP_LOGW(TAG, "BMS not ready after %d ms, probing once more", INIT_DELAY + START_DELAY);
+    probe();
+    ota_metrics.handshake_probes++;
+    return NO_UPDATE;
+}
+
+// CRC-32 the BMS reports back: of the stream when raw, of the decoded image otherwise
+static uint32_t expected_crc32(void) {
+    return data_encoding == DATA_ENCODING_RAW ? image_crc32 : plain_crc32;
+}
+
+void send_verify() {
+    can_encode_verify(expected_crc32(), plain_len, &tx_msg);
+    transport->send(&tx_msg, pdMS_TO_TICKS(100));
+}
+
+// Sends the whole-image CRC-32 and waits for the BMS to report the CRC-32
+// of what it actually assembled. Catches lost or duplicated data frames
+// that the per-frame CRC-16 cannot see.
+esp_err_t verify_image_crc() {
+    send_verify();
+
+    TickType_t start = xTaskGetTickCount();
+    while ((xTaskGetTickCount() - start) < pdMS_TO_TICKS(VERIFY_TIMEOUT)) {
+        if (transport->recv(&rx_msg, pdMS_TO_TICKS(10)) != ESP_OK) continue;
+        can_capture_push(&rx_msg);
+        if (can_decode_response(&rx_msg) != BMS_VERIFY) continue;
+
+        uint32_t bms_crc32 = rx_msg.data[1] | (rx_msg.data[2] << 8) | (rx_msg.data[3] << 16) | ((uint32_t)rx_msg.data[4] << 24);
+        if (bms_crc32 != expected_crc32()) {
+            ESP_LOGE(TAG, "Image CRC mismatch! Sent: 0x%08lX, BMS: 0x%08lX", expected_crc32(), bms_crc32);
+            return ESP_ERR_INVALID_CRC;
+        }
+        ESP_LOGI(TAG, "Image CRC verified: 0x%08lX", expected_crc32());
+        return ESP_OK;
+    }
+    ESP_LOGE(TAG, "No image CRC response from BMS");
+    return ESP_ERR_TIMEOUT;
+}
+
+// Builds and transmits the data frame starting at `offset` in ota_image.
+// The last frame is padded with 0xFF, never read past the image.
+CAN_HOT_ATTR esp_err_t send_data_frame(uint32_t offset) {
+    if (data_framing == DATA_FRAMING_FULL) can_encode_data_full(&ota_image[offset], ota_image_len - offset, &tx_msg);
+    else can_encode_data(&ota_image[offset], ota_image_len - offset, &tx_msg);
+    return transport->send(&tx_msg, pdMS_TO_TICKS(100));
+}
+
+// Full framing: CRC-16 over the data frames of the current window as the BMS
+// received them, padding included
+esp_err_t send_burst_crc(void) {
+    uint8_t burst[MAX_BURST_FRAMES * FRAME_PAYLOAD_FULL];
+    size_t len = window_frames * FRAME_PAYLOAD_FULL;
+    size_t avail = ota_image_len - window_start;
+    memset(burst, 0xFF, len);
+    memcpy(burst, &ota_image[window_start], avail < len ? avail : len);
+    can_encode_burst_crc(calcrc(burst, len), window_frames, &tx_msg);
+    return transport->send(&tx_msg, pdMS_TO_TICKS(100));
+}
+
+// Picks the data framing once the BMS has answered the handshake
+void select_framing(void) {
+    data_framing = DATA_FRAMING_LEGACY;
+    frame_payload = FRAME_PAYLOAD;
+    burst_frames = BURST_FRAMES;
+#if CONFIG_BMS_FULL_FRAMES
+    if (bms_caps & BMS_CAP_FULL_FRAMES) {
+        data_framing = DATA_FRAMING_FULL;
+        frame_payload = FRAME_PAYLOAD_FULL;
+        if (bms_caps_burst) burst_frames = bms_caps_burst > MAX_BURST_FRAMES ? MAX_BURST_FRAMES : bms_caps_burst;
+        ota_metrics.full_frame_sessions = 1;
+        ota_metrics.page_blocks = page_count;
+        ESP_LOGI(TAG, "BMS takes full frames, %d per burst", burst_frames);
+    }
+#endif
+}
+
+// Fill frame for `len` bytes from `offset`, all equal to ota_image[offset]
+esp_err_t send_fill_frame(uint32_t offset, uint32_t len) {
+    can_encode_fill(offset, len, ota_image[offset], &tx_msg);
+    return transport->send(&tx_msg, pdMS_TO_TICKS(100));
+}
+
+// CRC-32 of `len` copies of `value`, continuing from `crc`
+static uint32_t crc32_fill(uint32_t crc, uint8_t value, uint32_t len) {
+    uint8_t block[64];
+    memset(block, value, sizeof(block));
+    while (len) {
+        uint32_t n = len < sizeof(block) ? len : sizeof(block);
+        crc = esp_crc32_le(crc, block, n);
+        len -= n;
+    }
+    return crc;
 }
 
 // --- STATE MACHINE FUNCTIONS ---
 
 state runstate_begin_update() {
-    if(ota_sent_bytes >= firmware_len) {
+    if(ota_sent_bytes >= ota_image_len) {
         return ABORT_UPDATE;
     } else {
         return RECIVE_REQUEST;
     }
 }
 
+// Rewinds to the last offset the BMS acknowledged and restarts that window.
+// Alternates between waiting for a fresh request and resending straight away,
+// since the BMS may or may not have seen its own request answered.
+state resync_window(void) {
+    if (transfer_aborted) return ABORT_UPDATE;
+    if (++resync_count > RESYNC_LIMIT) {
+        ESP_LOGE(TAG, "BMS did not resync after %d attempts", RESYNC_LIMIT);
+        transfer_aborted = true;
+        publish_status(OTA_STATE_FAILED, bus_fault ? OTA_ERR_BUS_OFF : OTA_ERR_BMS_TIMEOUT);
+        return ABORT_UPDATE;
+    }
+
+    ESP_LOGW(TAG, "Resync %d: resuming from offset %ld", resync_count, acked_offset);
+    ota_metrics.resyncs++;
+    bus_fault = false;
+    byte_count = acked_offset;
+    ota_sent_bytes = acked_offset;
+    image_crc32 = acked_crc32;
+    window_frames = 0;
+    window_fill_len = 0;
+    publish_status(live_status.state, live_status.error);
+    return (resync_count & 1) ? RECIVE_REQUEST : SEND_HEX_DATA;
+}
+
 state runstate_recieve_request() {
-    // BLOCKING WAIT (Exactly like original code)
-    // Waits forever until BMS requests data
-    while(recieve_twai() != REQUEST_RECIEVE_MSG){
-        // Optional: Add vTaskDelay(1) here if Watchdog triggers, 
-        // but original code didn't have it.
+    // BLOCKING WAIT, bounded by RESPONSE_TIMEOUT and the bus supervisor
+    TickType_t start = xTaskGetTickCount();
+    uint16_t status;
+    while((status = recieve_twai()) != REQUEST_RECIEVE_MSG){
+        if (status == BUS_FAULT || (xTaskGetTickCount() - start) > pdMS_TO_TICKS(RESPONSE_TIMEOUT)) {
+            return resync_window();
+        }
     };
     return SEND_HEX_DATA;
 }
 
+// Counts one resend of `frame` in the current window.
+// Returns false once the frame has used up FRAME_RETRY_LIMIT.
+bool count_retry(uint8_t frame) {
+    if (++frame_retries[frame] > FRAME_RETRY_LIMIT) {
+        ESP_LOGE(TAG, "Frame %d at offset %ld exceeded %d retries", frame, window_start + frame * frame_payload, FRAME_RETRY_LIMIT);
+        transfer_aborted = true;
+        publish_status(OTA_STATE_FAILED, OTA_ERR_RETRY_LIMIT);
+        return false;
+    }
+    ota_metrics.retries++;
+    ota_metrics.retransmit_bytes += frame_payload;
+    return true;
+}
+
+// Resends a single frame of the current window, never the whole burst
+bool resend_frame(uint8_t frame) {
+    while (count_retry(frame)) {
+        esp_err_t err = window_fill_len ? send_fill_frame(window_start, window_fill_len) : send_data_frame(window_start + frame * frame_payload);
+        if (err == ESP_OK) return true;
+        ota_metrics.tx_failures++;
+        if (supervise_bus()) return false;
+        vTaskDelay(pdMS_TO_TICKS(CAN_SEND_DELAY));
+    }
+    return false;
+}
+
+// Full framing: the burst CRC only says the burst is bad, so every frame and the CRC go again
+bool resend_window(void) {
+    for (uint8_t i = 0; i < window_frames; i++) {
+        if (!resend_frame(i)) return false;
+    }
+    if (send_burst_crc() == ESP_OK) return true;
+    ota_metrics.tx_failures++;
+    return false;
+}
+
+// Sends the rest of `run` from byte_count as one fill frame, in place of a burst
+state runstate_send_fill(const fill_run_t *run) {
+    window_fill_len = run->offset + run->len - byte_count;
+    frame_retries[0] = 0;
+    if (send_fill_frame(byte_count, window_fill_len) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send fill frame");
+        ota_metrics.tx_failures++;
+        if (!resend_frame(0)) return bus_fault ? resync_window() : ABORT_UPDATE;
+    }
+    ESP_LOGI(TAG, "Fill: %ld x %02X at %ld", window_fill_len, run->value, byte_count);
+
+    image_crc32 = crc32_fill(image_crc32, run->value, window_fill_len);
+    last_frame_us = esp_timer_get_time();
+    ota_metrics.frames_sent++;
+    ota_metrics.fill_frames++;
+    ota_metrics.fill_bytes += window_fill_len;
+    ota_sent_bytes += window_fill_len;
+    byte_count += window_fill_len;
+    window_frames = 1;
+    live_status.phase = OTA_PHASE_WAIT_ACK;
+    publish_status(live_status.state, live_status.error);
+    return RECIVE_COMPLETE;
+}
+
 state runstate_send_hex_data() {
-    int i = 0;
-    tx_msg = (twai_message_t){ .extd = 1, .identifier = 0x047B84, .data_length_code = 8, .data = {0,0,0,0,0,0,0,0} };
-    
-    for(i = 0; i < 2; i++) {
-        if(ota_sent_bytes >= firmware_len) break;
-
-        // READ FROM RAM BUFFER
-        tx_msg.data[0] = firmware_buffer[byte_count];
-        tx_msg.data[1] = firmware_buffer[byte_count + 1];
-        tx_msg.data[2] = firmware_buffer[byte_count + 2];
-        tx_msg.data[3] = firmware_buffer[byte_count + 3];
-        tx_msg.data[4] = firmware_buffer[byte_count + 4];
-        tx_msg.data[5] = firmware_buffer[byte_count + 5];
-
-        uint16_t crc = calcrc(tx_msg.data, 6);
-        tx_msg.data[6] = crc & 0xFF; 
-        tx_msg.data[7] = crc >> 8;
-
-        if(twai_transmit(&tx_msg, pdMS_TO_TICKS(100)) == ESP_OK) {
-            ESP_LOGI(TAG, "Sent: %02X %02X ... (%ld/%d)", tx_msg.data[0], tx_msg.data[1], ota_sent_bytes, firmware_len);
-            ota_sent_bytes += 6;
-            byte_count += 6;
-        } else {
+    window_start = byte_count;
+    window_frames = 0;
+    window_fill_len = 0;
+    burst_start_us = esp_timer_get_time();
+    live_status.phase = OTA_PHASE_SENDING;
+
+    const fill_run_t *run = sparse_run_at(fill_runs, fill_run_count, byte_count);
+    if (run) return runstate_send_fill(run);
+
+    // The burst CRC carries the frame count, so with full framing a burst can stop at the end of a flash page
+    uint32_t burst_end = data_framing == DATA_FRAMING_FULL ?
+                         flash_block_end(page_ends, page_count, byte_count, ota_image_len) : ota_image_len;
+    for(int i = 0; i < burst_frames; i++) {
+        if(ota_sent_bytes >= ota_image_len || byte_count >= burst_end) break;
+
+        frame_retries[i] = 0;
+        if (send_data_frame(byte_count) != ESP_OK) {
             ESP_LOGE(TAG, "Failed to send message");
+            ota_metrics.tx_failures++;
+            if (!resend_frame(i)) return bus_fault ? resync_window() : ABORT_UPDATE;
         }
+        ESP_LOGI(TAG, "Sent: %02X %02X ... (%ld/%d)", tx_msg.data[0], tx_msg.data[1], ota_sent_bytes, ota_image_len);
+
+        size_t len = ota_image_len - byte_count;
+        if (len > frame_payload) len = frame_payload;
+        image_crc32 = esp_crc32_le(image_crc32, &ota_image[byte_count], len);
+        // Gap between frames of one burst: pure gateway-side TX jitter, no BMS in the loop
+        int64_t sent_us = esp_timer_get_time();
+        if (window_frames > 0) frame_jitter_record(sent_us - last_frame_us);
+        last_frame_us = sent_us;
+        ota_metrics.frames_sent++;
+        ota_sent_bytes += frame_payload;
+        byte_count += frame_payload;
+        window_frames++;
         vTaskDelay(pdMS_TO_TICKS(CAN_SEND_DELAY));
     }
+    if (data_framing == DATA_FRAMING_FULL && window_frames && send_burst_crc() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to send burst CRC");
+        ota_metrics.tx_failures++;
+        return resync_window();
+    }
+    live_status.phase = OTA_PHASE_WAIT_ACK;
+    publish_status(live_status.state, live_status.error);
     return RECIVE_COMPLETE;
 }
 
 state runstate_recieve_complete() {
-    // BLOCKING WAIT (Exactly like original code)
-    while(recieve_twai() != COMPLETE_RECIEVE_MSG){};
+    // BLOCKING WAIT, bounded by RESPONSE_TIMEOUT and the bus supervisor
+    // A NACK names the frame of this window that failed its CRC on the BMS side
+    TickType_t start = xTaskGetTickCount();
+    uint16_t status;
+    while((status = recieve_twai()) != COMPLETE_RECIEVE_MSG){
+        if (status == BUS_FAULT || (xTaskGetTickCount() - start) > pdMS_TO_TICKS(RESPONSE_TIMEOUT)) {
+            return resync_window();
+        }
+        if (status != NACK_RECIEVE_MSG) continue;
+        if (nack_frame_index == BURST_NACK_ALL && data_framing == DATA_FRAMING_FULL && !window_fill_len) {
+            ESP_LOGW(TAG, "Burst CRC NACK, resending %d frames", window_frames);
+            ota_metrics.nacks++;
+            if (!resend_window()) return bus_fault ? resync_window() : ABORT_UPDATE;
+            continue;
+        }
+        if (nack_frame_index >= window_frames) {
+            ESP_LOGW(TAG, "NACK for frame %d outside window of %d", nack_frame_index, window_frames);
+            continue;
+        }
+        ESP_LOGW(TAG, "NACK for frame %d, resending", nack_frame_index);
+        ota_metrics.nacks++;
+        if (!resend_frame(nack_frame_index)) return bus_fault ? resync_window() : ABORT_UPDATE;
+    };
+    acked_offset = byte_count;
+    acked_crc32 = image_crc32;
+    resync_count = 0;
+    ota_metrics.bursts++;
+
+    // Rates are measured over the whole cycle (request, burst, complete), RTT over the burst only
+    int64_t now = esp_timer_get_time();
+    uint32_t rtt = now - burst_start_us;
+    burst_rtt_avg = ewma(burst_rtt_avg, rtt);
+    if (rtt > ota_metrics.ack_latency_max_us) ota_metrics.ack_latency_max_us = rtt;
+    if (last_burst_end_us) {
+        float interval_s = (now - last_burst_end_us) / 1e6f;
+        uint32_t bytes = byte_count - window_start;
+        goodput_avg = ewma(goodput_avg, bytes / interval_s);
+        frame_rate_avg = ewma(frame_rate_avg, window_frames / interval_s);
+    }
+    last_burst_end_us = now;
     return BEGIN_UPDATE;
 }
 
@@ -260,7 +660,6 @@ void ota_update_state_machine() {
                 break;
             case ABORT_UPDATE:
                 enable_update = false;
-                strcpy(ota_status_msg, "Done"); // UI Feedback
                 break;
         }
     }
@@ -268,53 +667,234 @@ void ota_update_state_machine() {
 
 // --- MAIN TASK ---
 
-void ota_task_entry(void *arg) {
-    ESP_LOGI(TAG, "CAN Task Started. RAM Size: %d", firmware_len);
+void accumulate_metrics(void) {
+    ota_metrics_total.sessions++;
+    ota_metrics_total.frames_sent += ota_metrics.frames_sent;
+    ota_metrics_total.tx_failures += ota_metrics.tx_failures;
+    ota_metrics_total.nacks += ota_metrics.nacks;
+    ota_metrics_total.retries += ota_metrics.retries;
+    ota_metrics_total.retransmit_bytes += ota_metrics.retransmit_bytes;
+    ota_metrics_total.rx_missed += ota_metrics.rx_missed;
+    ota_metrics_total.rx_overrun += ota_metrics.rx_overrun;
+    ota_metrics_total.hw_filter_sessions += ota_metrics.hw_filter_sessions;
+    ota_metrics_total.full_frame_sessions += ota_metrics.full_frame_sessions;
+    ota_metrics_total.bus_off += ota_metrics.bus_off;
+    ota_metrics_total.bus_recoveries += ota_metrics.bus_recoveries;
+    ota_metrics_total.err_passive += ota_metrics.err_passive;
+    ota_metrics_total.rx_queue_full += ota_metrics.rx_queue_full;
+    ota_metrics_total.arb_lost += ota_metrics.arb_lost;
+    ota_metrics_total.resyncs += ota_metrics.resyncs;
+    ota_metrics_total.uds_pending += ota_metrics.uds_pending;
+    ota_metrics_total.bursts += ota_metrics.bursts;
+    ota_metrics_total.flash_pauses += ota_metrics.flash_pauses;
+    ota_metrics_total.flash_pause_ms += ota_metrics.flash_pause_ms;
+    ota_metrics_total.flash_busy += ota_metrics.flash_busy;
+    ota_metrics_total.page_blocks += ota_metrics.page_blocks;
+    ota_metrics_total.handshake_ms += ota_metrics.handshake_ms;
+    ota_metrics_total.transfer_ms += ota_metrics.transfer_ms;
+    ota_metrics_total.image_bytes += ota_metrics.image_bytes;
+    ota_metrics_total.stream_bytes += ota_metrics.stream_bytes;
+    ota_metrics_total.fill_frames += ota_metrics.fill_frames;
+    ota_metrics_total.fill_bytes += ota_metrics.fill_bytes;
+    ota_metrics_total.handshake_probes += ota_metrics.handshake_probes;
+    ota_metrics_total.bms_ready_ms += ota_metrics.bms_ready_ms;
+    ota_metrics_total.start_ready_ms += ota_metrics.start_ready_ms;
+    if (ota_metrics.uds_block_len) ota_metrics_total.uds_block_len = ota_metrics.uds_block_len;
+    if (ota_metrics.ack_latency_max_us > ota_metrics_total.ack_latency_max_us) {
+        ota_metrics_total.ack_latency_max_us = ota_metrics.ack_latency_max_us;
+    }
+}
+
+bool ota_claim_bus(void) {
+    bool claimed = false;
+    portENTER_CRITICAL(&busy_lock);
+    if (!SYSTEM_IS_BUSY) {
+        SYSTEM_IS_BUSY = true;
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&busy_lock);
+    // A running capture only holds the bus while nothing else needs it
+    if (!claimed) claimed = can_capture_yield();
+    return claimed;
+}
+
+void ota_release_bus(void) {
+    SYSTEM_IS_BUSY = false;
+}
+
+esp_err_t run_can_update(const uint8_t *image, size_t len, can_transport_kind_t kind, uint8_t encoding, bool page_align) {
+    esp_err_t result = ESP_FAIL;
+
+    // Stage the data stream in the arena's scratch end. Compression is only used if it actually saves bytes.
+    session_arena_scratch_reset();
+    uint8_t *packed = NULL;
+    size_t stream_len = len;
+    if (encoding == DATA_ENCODING_LZSS) {
+        packed = session_arena_scratch_alloc(len);
+        stream_len = (packed && len > 1) ? lzss_encode(image, len, packed, len - 1) : 0;
+        if (stream_len == 0) {
+            ESP_LOGW(TAG, "Compression %s, sending raw", packed ? "saves nothing" : "out of memory");
+            session_arena_scratch_reset();
+            packed = NULL;
+            encoding = DATA_ENCODING_RAW;
+            stream_len = len;
+        }
+    }
+    // Sparse streams are the raw image; only the runs are needed
+    fill_runs = NULL;
+    fill_run_count = 0;
+    if (encoding == DATA_ENCODING_SPARSE) {
+        size_t count = sparse_find_runs(image, len, CONFIG_BMS_SPARSE_PAGE_SIZE, NULL, 0);
+        fill_runs = count ? session_arena_scratch_alloc(count * sizeof(fill_run_t)) : NULL;
+        if (fill_runs) {
+            fill_run_count = sparse_find_runs(image, len, CONFIG_BMS_SPARSE_PAGE_SIZE, fill_runs, count);
+            uint32_t raw_frames = sparse_count_frames(len, NULL, 0, BURST_FRAMES);
+            uint32_t sparse_frames = sparse_count_frames(len, fill_runs, fill_run_count, BURST_FRAMES);
+            ESP_LOGI(TAG, "Sparse: %d runs, %ld of %ld frames eliminated", fill_run_count,
+                     raw_frames - sparse_frames, raw_frames);
+        } else {
+            ESP_LOGW(TAG, "No fill runs%s, sending raw", count ? " (out of memory)" : "");
+            encoding = DATA_ENCODING_RAW;
+        }
+    }
+    // Page-aligned blocks; a compressed stream does not map onto flash addresses
+    page_ends = NULL;
+    page_count = 0;
+    if (!page_align) ESP_LOGI(TAG, "Page alignment off for this transfer");
+    if (page_align && encoding != DATA_ENCODING_LZSS) {
+        flash_geometry_t geometry;
+        flash_geometry_config(&geometry);
+        // Only full frames are cut at block ends
+        if (geometry.page_bytes && !flash_pages_frame_aligned(&geometry, FRAME_PAYLOAD_FULL)) {
+            ESP_LOGW(TAG, "Page boundaries (%ld + n x %ld) fall inside frames, bursts are not page-aligned",
+                     geometry.align, geometry.page_bytes);
+        }
+        size_t count = flash_split_pages(&geometry, FRAME_PAYLOAD_FULL, len, NULL, 0);
+        page_ends = count ? session_arena_scratch_alloc(count * sizeof(uint32_t)) : NULL;
+        if (page_ends) page_count = flash_split_pages(&geometry, FRAME_PAYLOAD_FULL, len, page_ends, count);
+        else if (count) ESP_LOGW(TAG, "No page blocks (out of memory), bursts are not page-aligned");
+    }
+    data_encoding = encoding;
+    plain_len = len;
+    plain_crc32 = (encoding == DATA_ENCODING_RAW) ? 0 : esp_crc32_le(0, image, len);
+
+    ota_image = packed ? packed : image;
+    ota_image_len = stream_len;
+    transport = can_transport_get(kind);
+    ESP_LOGI(TAG, "CAN Task Started. RAM Size: %d, stream: %d, transport: %s", len, ota_image_len, transport->name);
     
-    initialize_twai();
+    memset((void *)&ota_metrics, 0, sizeof(ota_metrics));
+    session_start_us = esp_timer_get_time();
+    ota_metrics.image_bytes = len;
+    ota_metrics.stream_bytes = stream_len;
     
     ota_sent_bytes = 0;
     byte_count = 0;
+    image_crc32 = 0;
+    acked_offset = 0;
+    acked_crc32 = 0;
+    resync_count = 0;
+    bus_fault = false;
+    transfer_aborted = false;
     OTA_update_flag = false;
     flash_write_status = false;
+    bms_caps = 0;
+    bms_caps_burst = 0;
+    select_framing();
+    last_burst_end_us = 0;
+    frame_jitter_reset();
+    goodput_avg = frame_rate_avg = burst_rtt_avg = flash_pause_avg = 0;
     
-    strcpy(ota_status_msg, "Initializing...");
+    // Progress and ETA count stream bytes, which is what crosses the bus
+    live_status = (ota_status_t){ .busy = true, .total = stream_len, .phase = OTA_PHASE_HANDSHAKE, .transport = kind,
+                                  .protocol = encoding == DATA_ENCODING_LZSS ? OTA_PROTOCOL_LZSS :
+                                              encoding == DATA_ENCODING_SPARSE ? OTA_PROTOCOL_SPARSE : OTA_PROTOCOL_LEGACY };
+    publish_status(OTA_STATE_INITIALIZING, OTA_ERR_NONE);
+
+    // A longer stream would be announced modulo 64 KB and only fail at the verify
+    bool too_large = stream_len > MAX_STREAM_LEN;
+    if (too_large) ESP_LOGE(TAG, "Stream of %d bytes does not fit the size frame (max %d)", stream_len, MAX_STREAM_LEN);
+    if (too_large || transport->open(stream_len, ID_BMS_RESPONSE) != ESP_OK) {
+        publish_status(OTA_STATE_FAILED, too_large ? OTA_ERR_IMAGE_TOO_LARGE : OTA_ERR_TRANSPORT);
+        live_status.busy = false;
+        live_status.phase = OTA_PHASE_IDLE;
+        ota_status_publish(&live_status);
+        return ESP_FAIL;
+    }
 
-    // 1. Initial Sequence (Matched Code B)
-    vTaskDelay(pdMS_TO_TICKS(INIT_DELAY));
-    send_start_cmd();
-    send_size();
-    send_start_handshake();
+    // 1. Initial Sequence (Matched Code B), sent until the BMS answers instead of after a fixed INIT_DELAY
+    uint16_t pending = wait_bms_ready(send_session_probe, HANDSHAKE_INIT);
+    ota_metrics.bms_ready_ms = (esp_timer_get_time() - session_start_us) / 1000;
 
     ESP_LOGI(TAG, "Entering Main Loop");
 
+    TickType_t last_activity = xTaskGetTickCount();
     while(1) {
         // Check if user requested stop (optional, but good for web)
         // if (!SYSTEM_IS_BUSY) break; 
 
-        uint16_t status = recieve_twai();
+        // A readiness answer consumed while probing is handled as if it had just arrived
+        uint16_t status = pending != NO_UPDATE ? pending : recieve_twai();
+        pending = NO_UPDATE;
+        if (transfer_aborted) break;
+
+        if (status == HANDSHAKE_INIT || status == UPDATE_ONGOING) {
+            last_activity = xTaskGetTickCount();
+        } else if ((xTaskGetTickCount() - last_activity) > pdMS_TO_TICKS(SESSION_START_TIMEOUT)) {
+            // BMS went silent, don't hold the bus (and SYSTEM_IS_BUSY) forever
+            ESP_LOGE(TAG, "BMS silent for %d ms", SESSION_START_TIMEOUT);
+            publish_status(OTA_STATE_FAILED, OTA_ERR_BMS_TIMEOUT);
+            break;
+        }
 
         if(status == HANDSHAKE_INIT) {
             send_reset_BMS();
             ESP_LOGI(TAG, "HANDSHAKE OK");
-            strcpy(ota_status_msg, "Handshake OK");
+            publish_status(OTA_STATE_HANDSHAKE_OK, OTA_ERR_NONE);
             
-            // Wait for Start (Blocking)
-            while(recieve_twai() != START_UPDATE){};
-            
-            vTaskDelay(pdMS_TO_TICKS(INIT_DELAY));
-            send_start_cmd();
-            send_size();
+            // Wait for Start (Blocking, bounded)
+            TickType_t start = xTaskGetTickCount();
+            while(recieve_twai() != START_UPDATE && !transfer_aborted){
+                if ((xTaskGetTickCount() - start) > pdMS_TO_TICKS(SESSION_START_TIMEOUT)) {
+                    publish_status(OTA_STATE_FAILED, OTA_ERR_BMS_TIMEOUT);
+                    transfer_aborted = true;
+                }
+            };
+            if (transfer_aborted) break;
+
+            select_framing();
+            int64_t start_us = esp_timer_get_time();
+            pending = wait_bms_ready(send_data_probe, UPDATE_ONGOING);
+            ota_metrics.start_ready_ms = (esp_timer_get_time() - start_us) / 1000;
             ESP_LOGI(TAG, "STARTING OTA");
-            strcpy(ota_status_msg, "Flashing...");
+            data_start_us = esp_timer_get_time();
+            ota_metrics.handshake_ms = (data_start_us - session_start_us) / 1000;
+            live_status.phase = OTA_PHASE_WAIT_ACK;
+            publish_status(OTA_STATE_FLASHING, OTA_ERR_NONE);
         }
         else if(status == UPDATE_ONGOING) {
             ota_update_state_machine();
-            
+            if (transfer_aborted) break;
+
             // If machine finishes, we assume success and break the task
-            if(ota_sent_bytes >= firmware_len) {
+            if(ota_sent_bytes >= ota_image_len) {
+                ota_metrics.transfer_ms = (esp_timer_get_time() - data_start_us) / 1000;
+                if (VERIFY_ALWAYS || (bms_caps & BMS_CAP_VERIFY_CRC)) {
+                    live_status.phase = OTA_PHASE_VERIFY;
+                    publish_status(OTA_STATE_VERIFYING, OTA_ERR_NONE);
+                    esp_err_t err = verify_image_crc();
+                    if (err != ESP_OK) {
+                        publish_status(OTA_STATE_FAILED, err == ESP_ERR_TIMEOUT ? OTA_ERR_VERIFY_TIMEOUT : OTA_ERR_VERIFY_MISMATCH);
+                        break;
+                    }
+                }
                 ESP_LOGI(TAG, "Update Finished Successfully");
-                strcpy(ota_status_msg, "Success");
+                publish_status(OTA_STATE_SUCCESS, OTA_ERR_NONE);
+                // The planner is calibrated by raw, legacy-framed transfers only
+                if (data_encoding == DATA_ENCODING_RAW && data_framing == DATA_FRAMING_LEGACY) {
+                    transfer_plan_calibrate(kind, len, &ota_metrics);
+                }
+                result = ESP_OK;
                 break; 
             }
         }
@@ -326,12 +906,103 @@ void ota_task_entry(void *arg) {
         vTaskDelay(pdMS_TO_TICKS(10));
     }
 
-    release_twai();
-    SYSTEM_IS_BUSY = false;
+    twai_status_info_t info;
+    if (transport->get_status(&info) == ESP_OK) {
+        ota_metrics.rx_missed = info.rx_missed_count;
+        ota_metrics.rx_overrun = info.rx_overrun_count;
+    }
+    accumulate_metrics();
+
+    transport->close();
+    live_status.busy = false;
+    live_status.phase = OTA_PHASE_IDLE;
+    ota_status_publish(&live_status);
+    return result;
+}
+
+// --- ISO-TP BENCHMARK ---
+
+esp_err_t run_isotp_bench(const uint8_t *image, size_t len, can_transport_kind_t kind,
+                          uint8_t block_size, uint8_t st_min, isotp_bench_t *out) {
+    const can_transport_t *link_transport = can_transport_get(kind);
+    memset(out, 0, sizeof(*out));
+    esp_err_t err = link_transport->open(len, CONFIG_BMS_ISOTP_RESPONSE_ID);
+    if (err != ESP_OK) return err;
+    sim_bms_set_isotp_flow(block_size, st_min);
+
+    isotp_link_t link;
+    isotp_link_init(&link, link_transport, CONFIG_BMS_ISOTP_REQUEST_ID, CONFIG_BMS_ISOTP_RESPONSE_ID);
+
+    int64_t start_us = esp_timer_get_time();
+    size_t pos = 0;
+    while (err == ESP_OK && pos < len) {
+        size_t seg = len - pos;
+        if (seg > CONFIG_BMS_ISOTP_SEGMENT_LEN) seg = CONFIG_BMS_ISOTP_SEGMENT_LEN;
+        err = isotp_send(&link, image + pos, seg);
+        if (err == ESP_OK) {
+            pos += seg;
+            out->segments++;
+        }
+    }
+    out->elapsed_us = esp_timer_get_time() - start_us;
+    out->bytes = pos;
+    out->frames = link.frames_sent;
+    out->fc_frames = link.fc_received;
+    out->fc_waits = link.fc_waits;
+    out->goodput_bps = out->elapsed_us ? (uint64_t)pos * 1000000 / out->elapsed_us : 0;
+    out->received = sim_bms_isotp_bytes();
+    link_transport->close();
+
+    ESP_LOGI(TAG, "ISO-TP %s: %ld bytes in %ld us (%ld B/s), %ld frames, %ld FC",
+             link_transport->name, out->bytes, out->elapsed_us, out->goodput_bps, out->frames, out->fc_frames);
+    return err;
+}
+
+// --- PROTOCOL SELECTION ---
+
+static const char *protocol_names[OTA_PROTOCOL_COUNT] = {
+    [OTA_PROTOCOL_LEGACY] = "legacy",
+    [OTA_PROTOCOL_UDS] = "uds",
+    [OTA_PROTOCOL_LZSS] = "lzss",
+    [OTA_PROTOCOL_SPARSE] = "sparse",
+};
+
+// Data stream encoding of each protocol that runs on the legacy engine
+static const uint8_t protocol_encodings[OTA_PROTOCOL_COUNT] = {
+    [OTA_PROTOCOL_LEGACY] = DATA_ENCODING_RAW,
+    [OTA_PROTOCOL_LZSS] = DATA_ENCODING_LZSS,
+    [OTA_PROTOCOL_SPARSE] = DATA_ENCODING_SPARSE,
+};
+
+const char *ota_protocol_name(ota_protocol_t protocol) {
+    return (protocol < OTA_PROTOCOL_COUNT) ? protocol_names[protocol] : "unknown";
+}
+
+bool ota_protocol_from_name(const char *name, ota_protocol_t *out) {
+    for (int i = 0; i < OTA_PROTOCOL_COUNT; i++) {
+        if (strcmp(name, protocol_names[i]) == 0) {
+            *out = (ota_protocol_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+esp_err_t run_update(const uint8_t *image, size_t len, can_transport_kind_t kind, ota_protocol_t protocol, bool page_align) {
+    if (protocol == OTA_PROTOCOL_UDS) return run_uds_update(image, len, kind);
+    return run_can_update(image, len, kind, protocol < OTA_PROTOCOL_COUNT ? protocol_encodings[protocol] : DATA_ENCODING_RAW, page_align);
+}
+
+// Task argument: transport in the low byte, protocol in the next
+void ota_task_entry(void *arg) {
+    intptr_t sel = (intptr_t)arg;
+    run_update(firmware_buffer, firmware_len, (can_transport_kind_t)(sel & 0xFF), (ota_protocol_t)((sel >> 8) & 0xFF), sel >> 16);
+    ota_release_bus();
     vTaskDelete(NULL);
 }
 
-esp_err_t start_can_update_task(void) {
-    xTaskCreatePinnedToCore(ota_task_entry, "ota_can_task", 4096, NULL, 5, NULL, 1);
-    return ESP_OK;
+esp_err_t start_can_update_task(can_transport_kind_t kind, ota_protocol_t protocol, bool page_align) {
+    intptr_t sel = kind | (protocol << 8) | (page_align << 16);
+    BaseType_t res = xTaskCreatePinnedToCore(ota_task_entry, "ota_can_task", CAN_TASK_STACK, (void *)sel, CAN_TASK_PRIORITY, NULL, CAN_TASK_CORE);
+    return (res == pdPASS) ? ESP_OK : ESP_FAIL;
 }
\ No newline at end of file
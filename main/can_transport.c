@@ -0,0 +1,157 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/twai.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "app_shared.h"
+#include "can_manager.h"
+#include "can_capture.h"
+#include "can_transport.h"
+#include "sim_bms.h"
+
+static const char *TAG = "CAN_XPORT";
+
+#define SUPERVISED_ALERTS (TWAI_ALERT_BUS_OFF | TWAI_ALERT_BUS_RECOVERED | TWAI_ALERT_ERR_PASS | \
+                           TWAI_ALERT_ERR_ACTIVE | TWAI_ALERT_RX_QUEUE_FULL | TWAI_ALERT_ARB_LOST)
+
+// --- TWAI CONTROLLER ---
+
+static esp_err_t install_twai(twai_mode_t mode, uint32_t rx_id) {
+    twai_general_config_t g_config = TWAI_GENERAL_CONFIG_DEFAULT(CAN_GPIO_TX, CAN_GPIO_RX, mode);
+    g_config.alerts_enabled = SUPERVISED_ALERTS;
+    twai_timing_config_t t_config = TWAI_TIMING_CONFIG_250KBITS();
+    twai_filter_config_t f_config = TWAI_FILTER_CONFIG_ACCEPT_ALL();
+
+#if CONFIG_BMS_OTA_HW_FILTER
+    // Let the controller drop pack telemetry so it never reaches the RX queue.
+    // A running capture wants the whole bus, so it keeps accept-all.
+    if (mode == TWAI_MODE_NORMAL && !can_capture_active()) {
+        const uint32_t session_ids[] = { rx_id };
+        f_config = can_filter_for_ids(session_ids, 1);
+        ota_metrics.hw_filter_sessions = 1;
+    }
+#endif
+
+    esp_err_t err = twai_driver_install(&g_config, &t_config, &f_config);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to install driver");
+        return err;
+    }
+    err = twai_start();
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start driver");
+        twai_driver_uninstall();
+        return err;
+    }
+    ESP_LOGI(TAG, "Driver started (%s)", mode == TWAI_MODE_NO_ACK ? "no-ack" : "normal");
+    return ESP_OK;
+}
+
+static void uninstall_twai(void) {
+    twai_stop();
+    twai_driver_uninstall();
+    ESP_LOGI(TAG, "Driver Released");
+}
+
+static esp_err_t twai_recover(TickType_t timeout) {
+    twai_initiate_recovery();
+
+    uint32_t alerts = 0;
+    TickType_t start = xTaskGetTickCount();
+    while ((xTaskGetTickCount() - start) < timeout) {
+        if (twai_read_alerts(&alerts, pdMS_TO_TICKS(50)) == ESP_OK && (alerts & TWAI_ALERT_BUS_RECOVERED)) {
+            return twai_start();
+        }
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t twai_open(size_t image_len, uint32_t rx_id) {
+    return install_twai(TWAI_MODE_NORMAL, rx_id);
+}
+
+static esp_err_t twai_send(const twai_message_t *msg, TickType_t timeout) {
+    return twai_transmit(msg, timeout);
+}
+
+// --- LOOPBACK: real controller without ACK, simulated BMS ---
+// Needs a transceiver on the pins but no pack: frames really go out on the
+// wire, the answers come from sim_bms.
+
+static esp_err_t loopback_open(size_t image_len, uint32_t rx_id) {
+    esp_err_t err = sim_bms_start(image_len);
+    if (err != ESP_OK) return err;
+    return install_twai(TWAI_MODE_NO_ACK, rx_id);
+}
+
+static void loopback_close(void) {
+    uninstall_twai();
+    sim_bms_stop();
+}
+
+static esp_err_t loopback_send(const twai_message_t *msg, TickType_t timeout) {
+    esp_err_t err = twai_transmit(msg, timeout);
+    if (err == ESP_OK) sim_bms_on_frame(msg);
+    return err;
+}
+
+// --- SIMULATION: no controller at all ---
+
+static esp_err_t sim_open(size_t image_len, uint32_t rx_id) {
+    return sim_bms_start(image_len);
+}
+
+static esp_err_t sim_send(const twai_message_t *msg, TickType_t timeout) {
+    sim_bms_on_frame(msg);
+    return ESP_OK;
+}
+
+static esp_err_t sim_no_alerts(uint32_t *alerts, TickType_t timeout) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t sim_no_recover(TickType_t timeout) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static esp_err_t sim_no_status(twai_status_info_t *info) {
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static const can_transport_t transports[CAN_TRANSPORT_COUNT] = {
+    [CAN_TRANSPORT_TWAI] = {
+        .name = "twai", .open = twai_open, .close = uninstall_twai,
+        .send = twai_send, .recv = twai_receive,
+        .read_alerts = twai_read_alerts, .recover = twai_recover, .get_status = twai_get_status_info,
+    },
+    [CAN_TRANSPORT_LOOPBACK] = {
+        .name = "loopback", .open = loopback_open, .close = loopback_close,
+        .send = loopback_send, .recv = sim_bms_receive,
+        .read_alerts = twai_read_alerts, .recover = twai_recover, .get_status = twai_get_status_info,
+    },
+    [CAN_TRANSPORT_SIM] = {
+        .name = "sim", .open = sim_open, .close = sim_bms_stop,
+        .send = sim_send, .recv = sim_bms_receive,
+        .read_alerts = sim_no_alerts, .recover = sim_no_recover, .get_status = sim_no_status,
+    },
+};
+
+const can_transport_t *can_transport_get(can_transport_kind_t kind) {
+    return (kind < CAN_TRANSPORT_COUNT) ? &transports[kind] : &transports[CAN_TRANSPORT_TWAI];
+}
+
+const char *can_transport_name(can_transport_kind_t kind) {
+    return can_transport_get(kind)->name;
+}
+
+bool can_transport_from_name(const char *name, can_transport_kind_t *out) {
+    for (int i = 0; i < CAN_TRANSPORT_COUNT; i++) {
+        if (strcmp(name, transports[i].name) == 0) {
+            *out = (can_transport_kind_t)i;
+            return true;
+        }
+    }
+    return false;
+}
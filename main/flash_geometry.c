@@ -0,0 +1,39 @@
+#include "sdkconfig.h"
+
+#include "flash_geometry.h"
+
+void flash_geometry_config(flash_geometry_t *out) {
+    *out = (flash_geometry_t){
+        .page_bytes = CONFIG_BMS_FLASH_PAGE_SIZE,
+        .write_ms = CONFIG_BMS_FLASH_WRITE_MS,
+        .align = CONFIG_BMS_FLASH_PAGE_SIZE ? CONFIG_BMS_FLASH_ALIGN % CONFIG_BMS_FLASH_PAGE_SIZE : 0,
+    };
+}
+
+bool flash_pages_frame_aligned(const flash_geometry_t *g, uint32_t frame_bytes) {
+    return g->page_bytes && frame_bytes && g->page_bytes % frame_bytes == 0 && g->align % frame_bytes == 0;
+}
+
+size_t flash_split_pages(const flash_geometry_t *g, uint32_t frame_bytes, size_t len, uint32_t *ends, size_t max) {
+    if (!flash_pages_frame_aligned(g, frame_bytes) || len == 0) return 0;
+
+    size_t count = 0;
+    size_t end = g->page_bytes - g->align % g->page_bytes;
+    for (;; end += g->page_bytes) {
+        if (end > len) end = len;
+        if (ends && count < max) ends[count] = end;
+        count++;
+        if (end == len) break;
+    }
+    return count;
+}
+
+uint32_t flash_block_end(const uint32_t *ends, size_t count, uint32_t offset, uint32_t len) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (ends[mid] <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < count ? ends[lo] : len;
+}
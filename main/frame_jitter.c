@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frame_jitter.h"
+#include "task_config.h"
+
+// Ring of recent gaps. Each slot is a single aligned 32-bit store, so a
+// reader may mix old and new samples but never sees a torn one.
+static uint32_t gaps[FRAME_JITTER_SAMPLES];
+static volatile uint32_t gap_count = 0;
+
+CAN_HOT_ATTR void frame_jitter_record(uint32_t gap_us) {
+    gaps[gap_count % FRAME_JITTER_SAMPLES] = gap_us;
+    gap_count++;
+}
+
+void frame_jitter_reset(void) {
+    gap_count = 0;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t percentile(const uint32_t *sorted, uint32_t n, uint32_t pct) {
+    uint32_t idx = (n * pct + 99) / 100; // Nearest rank
+    return sorted[idx ? idx - 1 : 0];
+}
+
+void frame_jitter_report(frame_jitter_report_t *out) {
+    memset(out, 0, sizeof(*out));
+    uint32_t n = gap_count;
+    if (n > FRAME_JITTER_SAMPLES) n = FRAME_JITTER_SAMPLES;
+    if (n == 0) return;
+
+    uint32_t *sorted = malloc(n * sizeof(uint32_t));
+    if (!sorted) return;
+    memcpy(sorted, gaps, n * sizeof(uint32_t));
+    qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+
+    out->samples = n;
+    out->p50_us = percentile(sorted, n, 50);
+    out->p90_us = percentile(sorted, n, 90);
+    out->p99_us = percentile(sorted, n, 99);
+    out->max_us = sorted[n - 1];
+    free(sorted);
+}
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "mbedtls/sha256.h"
+#include "sdkconfig.h"
+
+#include "image_cache.h"
+
+static const char *TAG = "IMG_CACHE";
+
+#define CACHE_PARTITION_LABEL "imgcache"
+#define CACHE_NVS_NAMESPACE "imgcache"
+#define CACHE_SLOT_SIZE (CONFIG_BMS_IMAGE_CACHE_SLOT_KB * 1024)
+#define FLASH_SECTOR_SIZE 4096
+
+// Persistent index, one entry per fixed-size slot. Stored as a single NVS blob.
+typedef struct {
+    bool valid;
+    image_cache_entry_t entry;
+} cache_slot_t;
+
+typedef struct {
+    uint32_t use_seq;
+    cache_slot_t slots[IMAGE_CACHE_MAX_SLOTS];
+} cache_index_t;
+
+static const esp_partition_t *cache_part = NULL;
+static cache_index_t cache_index;
+static int slot_count = 0;
+static SemaphoreHandle_t cache_lock = NULL;
+
+// RAM-only state of mapped slots
+static uint8_t pin_count[IMAGE_CACHE_MAX_SLOTS];
+static esp_partition_mmap_handle_t map_handle[IMAGE_CACHE_MAX_SLOTS];
+static const void *map_ptr[IMAGE_CACHE_MAX_SLOTS];
+
+// --- HELPERS (call with cache_lock held) ---
+
+static esp_err_t save_index(void) {
+    nvs_handle_t nvs;
+    esp_err_t err = nvs_open(CACHE_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err != ESP_OK) return err;
+    err = nvs_set_blob(nvs, "index", &cache_index, sizeof(cache_index));
+    if (err == ESP_OK) err = nvs_commit(nvs);
+    nvs_close(nvs);
+    return err;
+}
+
+static int find_slot(const uint8_t hash[IMAGE_HASH_LEN]) {
+    for (int i = 0; i < slot_count; i++) {
+        if (cache_index.slots[i].valid && memcmp(cache_index.slots[i].entry.hash, hash, IMAGE_HASH_LEN) == 0) return i;
+    }
+    return -1;
+}
+
+// Empty slot first, otherwise the least recently used one that isn't mapped
+static int victim_slot(void) {
+    int lru = -1;
+    for (int i = 0; i < slot_count; i++) {
+        if (!cache_index.slots[i].valid) return i;
+        if (pin_count[i]) continue;
+        if (lru < 0 || cache_index.slots[i].entry.last_use < cache_index.slots[lru].entry.last_use) lru = i;
+    }
+    return lru;
+}
+
+static void touch_slot(int slot) {
+    cache_index.slots[slot].entry.last_use = ++cache_index.use_seq;
+    save_index();
+}
+
+// --- PUBLIC API ---
+
+esp_err_t image_cache_init(void) {
+    cache_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CACHE_PARTITION_LABEL);
+    if (!cache_part) {
+        ESP_LOGW(TAG, "No '%s' partition, image cache disabled", CACHE_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    size_t budget = CONFIG_BMS_IMAGE_CACHE_BUDGET_KB * 1024;
+    if (budget > cache_part->size) budget = cache_part->size;
+    slot_count = budget / CACHE_SLOT_SIZE;
+    if (slot_count > IMAGE_CACHE_MAX_SLOTS) slot_count = IMAGE_CACHE_MAX_SLOTS;
+
+    cache_lock = xSemaphoreCreateMutex();
+    if (!cache_lock) return ESP_ERR_NO_MEM;
+
+    memset(&cache_index, 0, sizeof(cache_index));
+    nvs_handle_t nvs;
+    if (nvs_open(CACHE_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        size_t len = sizeof(cache_index);
+        if (nvs_get_blob(nvs, "index", &cache_index, &len) != ESP_OK || len != sizeof(cache_index)) {
+            memset(&cache_index, 0, sizeof(cache_index));
+        }
+        nvs_close(nvs);
+    }
+
+    // Slots beyond a reduced budget are dropped
+    int cached = 0;
+    for (int i = 0; i < IMAGE_CACHE_MAX_SLOTS; i++) {
+        if (i >= slot_count) cache_index.slots[i].valid = false;
+        else if (cache_index.slots[i].valid) cached++;
+    }
+    ESP_LOGI(TAG, "%d x %d KB slots, %d images cached", slot_count, CONFIG_BMS_IMAGE_CACHE_SLOT_KB, cached);
+    return ESP_OK;
+}
+
+void image_hash(const uint8_t *image, size_t len, uint8_t out[IMAGE_HASH_LEN]) {
+    mbedtls_sha256(image, len, out, 0);
+}
+
+esp_err_t image_cache_store(const uint8_t *image, size_t len, const char *label, uint8_t out_hash[IMAGE_HASH_LEN]) {
+    uint8_t hash[IMAGE_HASH_LEN];
+    image_hash(image, len, hash);
+    if (out_hash) memcpy(out_hash, hash, IMAGE_HASH_LEN);
+
+    if (!cache_part) return ESP_ERR_NOT_SUPPORTED;
+    if (len == 0 || len > CACHE_SLOT_SIZE) return ESP_ERR_INVALID_SIZE;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    int slot = find_slot(hash);
+    if (slot >= 0) {
+        touch_slot(slot);
+        xSemaphoreGive(cache_lock);
+        return ESP_OK;
+    }
+
+    slot = victim_slot();
+    if (slot < 0) {
+        xSemaphoreGive(cache_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Invalidate first so a power loss mid-write never leaves a bad entry
+    cache_slot_t *s = &cache_index.slots[slot];
+    if (s->valid) ESP_LOGI(TAG, "Evicting '%s' from slot %d", s->entry.label, slot);
+    s->valid = false;
+    save_index();
+
+    size_t offset = slot * CACHE_SLOT_SIZE;
+    size_t erase_len = (len + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    esp_err_t err = esp_partition_erase_range(cache_part, offset, erase_len);
+    if (err == ESP_OK) err = esp_partition_write(cache_part, offset, image, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Flash write failed: %s", esp_err_to_name(err));
+        xSemaphoreGive(cache_lock);
+        return err;
+    }
+
+    memcpy(s->entry.hash, hash, IMAGE_HASH_LEN);
+    s->entry.size = len;
+    strlcpy(s->entry.label, label ? label : "", IMAGE_LABEL_LEN);
+    s->valid = true;
+    touch_slot(slot);
+    xSemaphoreGive(cache_lock);
+
+    ESP_LOGI(TAG, "Stored '%s' (%d bytes) in slot %d", s->entry.label, len, slot);
+    return ESP_OK;
+}
+
+esp_err_t image_cache_lookup(const uint8_t hash[IMAGE_HASH_LEN], image_cache_entry_t *out) {
+    if (!cache_part) return ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    int slot = find_slot(hash);
+    if (slot >= 0 && out) *out = cache_index.slots[slot].entry;
+    xSemaphoreGive(cache_lock);
+    return (slot >= 0) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t image_cache_acquire(const uint8_t hash[IMAGE_HASH_LEN], const uint8_t **image, size_t *len) {
+    if (!cache_part) return ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    int slot = find_slot(hash);
+    if (slot < 0) {
+        xSemaphoreGive(cache_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t err = ESP_OK;
+    if (pin_count[slot] == 0) {
+        err = esp_partition_mmap(cache_part, slot * CACHE_SLOT_SIZE, cache_index.slots[slot].entry.size,
+                                 ESP_PARTITION_MMAP_DATA, &map_ptr[slot], &map_handle[slot]);
+    }
+    if (err == ESP_OK) {
+        pin_count[slot]++;
+        *image = map_ptr[slot];
+        *len = cache_index.slots[slot].entry.size;
+        touch_slot(slot);
+    }
+    xSemaphoreGive(cache_lock);
+    return err;
+}
+
+void image_cache_release(const uint8_t hash[IMAGE_HASH_LEN]) {
+    if (!cache_part) return;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    int slot = find_slot(hash);
+    if (slot >= 0 && pin_count[slot] > 0 && --pin_count[slot] == 0) {
+        esp_partition_munmap(map_handle[slot]);
+        map_ptr[slot] = NULL;
+    }
+    xSemaphoreGive(cache_lock);
+}
+
+size_t image_cache_list(image_cache_entry_t *out, size_t max) {
+    size_t n = 0;
+    if (!cache_part) return 0;
+
+    xSemaphoreTake(cache_lock, portMAX_DELAY);
+    for (int i = 0; i < slot_count && n < max; i++) {
+        if (!cache_index.slots[i].valid) continue;
+        // Insertion sort by last_use, newest first
+        size_t j = n++;
+        while (j > 0 && out[j - 1].last_use < cache_index.slots[i].entry.last_use) {
+            out[j] = out[j - 1];
+            j--;
+        }
+        out[j] = cache_index.slots[i].entry;
+    }
+    xSemaphoreGive(cache_lock);
+    return n;
+}
+
+void image_hash_to_hex(const uint8_t hash[IMAGE_HASH_LEN], char *out) {
+    for (int i = 0; i < IMAGE_HASH_LEN; i++) sprintf(out + i * 2, "%02x", hash[i]);
+}
+
+bool image_hash_from_hex(const char *hex, uint8_t hash[IMAGE_HASH_LEN]) {
+    if (strlen(hex) != IMAGE_HASH_LEN * 2) return false;
+    for (int i = 0; i < IMAGE_HASH_LEN; i++) {
+        unsigned int byte;
+        if (sscanf(hex + i * 2, "%2x", &byte) != 1) return false;
+        hash[i] = byte;
+    }
+    return true;
+}
@@ -12,8 +12,44 @@ extern volatile bool SYSTEM_IS_BUSY;
 extern uint8_t *firmware_buffer;
 extern size_t firmware_len;
 
-// Progress Tracking
-extern volatile uint32_t ota_sent_bytes;
-extern char ota_status_msg[32];
+// Transfer Metrics
+typedef struct {
+    uint32_t sessions;
+    uint32_t frames_sent;      // Data frames accepted by the driver (first send only)
+    uint32_t tx_failures;      // twai_transmit errors
+    uint32_t nacks;            // Frames the BMS reported with a bad CRC
+    uint32_t retries;          // Single-frame resends, for either reason
+    uint32_t retransmit_bytes;
+    uint32_t rx_missed;          // Driver RX queue overflows
+    uint32_t rx_overrun;         // Controller RX FIFO overruns
+    uint32_t hw_filter_sessions; // Sessions run with the acceptance filter (0/1 per session)
+    uint32_t ack_latency_max_us; // Worst burst-to-complete round trip
+    uint32_t bus_off;            // TWAI_ALERT_BUS_OFF events
+    uint32_t bus_recoveries;     // Bus-off events recovered within BUS_RECOVERY_TIMEOUT
+    uint32_t err_passive;        // Controller entered error passive
+    uint32_t rx_queue_full;      // TWAI_ALERT_RX_QUEUE_FULL events
+    uint32_t arb_lost;           // Lost arbitration (another node on the bus)
+    uint32_t resyncs;            // Windows resent from the last acknowledged offset
+    uint32_t uds_block_len;      // TransferData length used (UDS sessions only)
+    uint32_t uds_pending;        // responsePending (NRC 0x78) answers from the ECU
+    uint32_t bursts;             // Request/complete cycles acknowledged
+    uint32_t flash_pauses;       // BMS page writes (flash busy -> flash done)
+    uint32_t flash_pause_ms;     // Time spent in those page writes
+    uint32_t flash_busy;         // BMS_FLASH_BUSY answers (a page write started, or a frame arrived during one)
+    uint32_t page_blocks;        // Flash pages the bursts were aligned to (full frames only)
+    uint32_t handshake_ms;       // Transport open to the start of the data phase
+    uint32_t handshake_probes;   // Start/size(/handshake) sequences sent until the BMS answered
+    uint32_t bms_ready_ms;       // Transport open to the BMS handshake answer
+    uint32_t start_ready_ms;     // BMS start answer to the BMS taking the size (data phase ready)
+    uint32_t transfer_ms;        // Start of data phase to the last complete message
+    uint32_t image_bytes;        // Image length before encoding
+    uint32_t stream_bytes;       // Data frame payload after encoding (= image_bytes when raw)
+    uint32_t fill_frames;        // Fill frames sent in place of bursts (sparse sessions only)
+    uint32_t fill_bytes;         // Image bytes those fill frames covered
+    uint32_t full_frame_sessions; // Sessions sent with 8 byte frames and burst CRCs (0/1 per session)
+} ota_metrics_t;
+
+extern volatile ota_metrics_t ota_metrics;       // Current (or last) session
+extern volatile ota_metrics_t ota_metrics_total; // Since boot
 
 #endif // APP_SHARED_H
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef CAN_CAPTURE_H
+#define CAN_CAPTURE_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "driver/twai.h"
+
+#define CAPTURE_RING_LEN 512 // Frames, power of two
+#define CAPTURE_MAX_FILTERS 8
+
+typedef struct {
+    int64_t timestamp_us; // esp_timer time when the frame left the driver queue
+    twai_message_t msg;
+} capture_frame_t;
+
+typedef struct {
+    bool active;
+    uint32_t captured;   // Frames written to the ring
+    uint32_t dropped;    // Frames lost because the ring was full
+    uint32_t filtered;   // Frames skipped by the ID filter
+    uint32_t rx_missed;  // Driver RX queue overflows while capture owned the bus
+    uint32_t rx_overrun; // Controller FIFO overruns while capture owned the bus
+} capture_stats_t;
+
+// Starts capturing. `ids` (may be NULL) limits capture to those identifiers.
+// While no transfer runs, a capture task owns the bus; a claimant takes it
+// over through can_capture_yield() (called by ota_claim_bus). During a
+// transfer the CAN task feeds every frame it receives into the ring.
+esp_err_t can_capture_start(const uint32_t *ids, size_t id_count);
+void can_capture_stop(void);
+bool can_capture_active(void);
+
+// Asks the capture task to stop its driver and hand over SYSTEM_IS_BUSY.
+// Blocks until it has; returns false if capture does not own the bus.
+bool can_capture_yield(void);
+
+// Producer side, called by whoever owns the TWAI driver. Lock-free, never blocks.
+void can_capture_push(const twai_message_t *msg);
+
+// Consumer side. Returns false if the ring is empty.
+bool can_capture_pop(capture_frame_t *out);
+
+// Formats one frame as a `candump -L` line ("(sec.usec) can0 ID#DATA\n"). Returns its length.
+int can_capture_format(const capture_frame_t *frame, char *buf, size_t len);
+
+void can_capture_get_stats(capture_stats_t *out);
+
+#endif // CAN_CAPTURE_H
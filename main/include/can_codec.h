@@ -0,0 +1,52 @@
+#ifndef CAN_CODEC_H
+#define CAN_CODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "driver/twai.h"
+#include "can_protocol.h"
+
+// Encoders and decoder for the 0x7B84 family, generated from the tables in
+// can_protocol.h
+
+#define CAN_CODEC_ENUM(name, ...) name,
+
+typedef enum {
+    CAN_COMMANDS(CAN_CODEC_ENUM)
+    CAN_COMMAND_COUNT
+} can_command_t;
+
+typedef enum {
+    BMS_NONE = 0, // Not a BMS response, or a payload no table entry matches
+    BMS_RESPONSE_KINDS(CAN_CODEC_ENUM)
+    BMS_RESPONSE_COUNT
+} bms_response_t;
+
+// --- GATEWAY -> BMS ---
+void can_encode_command(can_command_t cmd, twai_message_t *out);
+// Data stream length (16 bits), encoding and framing; unless both are the
+// defaults, also the decoded image length and the burst length
+void can_encode_size(uint32_t stream_len, uint8_t encoding, uint32_t image_len, uint8_t framing, uint8_t burst_frames,
+                     twai_message_t *out);
+void can_encode_data(const uint8_t *payload, size_t len, twai_message_t *out); // Pads with 0xFF, appends CRC-16
+void can_encode_data_full(const uint8_t *payload, size_t len, twai_message_t *out); // 8 bytes, pads with 0xFF
+void can_encode_burst_crc(uint16_t crc, uint8_t frames, twai_message_t *out);
+void can_encode_verify(uint32_t image_crc32, uint32_t image_len, twai_message_t *out);
+void can_encode_fill(uint32_t offset, uint32_t len, uint8_t value, twai_message_t *out); // 24-bit offset and length
+
+// Reverse of can_encode_fill() for the simulated BMS; false if the check byte does not match
+bool can_decode_fill(const twai_message_t *msg, uint32_t *offset, uint32_t *len, uint8_t *value);
+
+// Reverse of can_encode_command() for the simulated BMS; CAN_COMMAND_COUNT if no command matches
+can_command_t can_decode_command(const twai_message_t *msg);
+
+// --- BMS -> GATEWAY ---
+// One table lookup for markers, one for sums; no per-kind branches
+bms_response_t can_decode_response(const twai_message_t *msg);
+
+// First table encoding of `kind` (simulated BMS). BMS_NACK and BMS_VERIFY
+// carry fields on top, see can_protocol.h.
+void can_encode_response(bms_response_t kind, twai_message_t *out);
+
+#endif // CAN_CODEC_H
@@ -2,10 +2,70 @@
 #define CAN_MANAGER_H
 
 #include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "driver/twai.h"
+#include "can_transport.h"
 
-// Starts the FreeRTOS task that handles the CAN update
+#define CAN_GPIO_RX 35
+#define CAN_GPIO_TX 32
+
+// Bootloader protocol spoken during a transfer
+typedef enum {
+    OTA_PROTOCOL_LEGACY = 0, // 0x7B84 lock-step protocol (this file)
+    OTA_PROTOCOL_UDS,        // ISO 14229 over ISO-TP (uds_client.c)
+    OTA_PROTOCOL_LZSS,       // Legacy protocol with an LZSS compressed data stream
+    OTA_PROTOCOL_SPARSE,     // Legacy protocol, constant pages sent as fill frames
+    OTA_PROTOCOL_COUNT
+} ota_protocol_t;
+
+const char *ota_protocol_name(ota_protocol_t protocol);
+// Parses "legacy", "uds", "lzss" or "sparse". Returns false for anything else.
+bool ota_protocol_from_name(const char *name, ota_protocol_t *out);
+
+// Starts the FreeRTOS task that flashes firmware_buffer with `protocol` over `kind`
 // Returns ESP_OK if started successfully
-esp_err_t start_can_update_task(void);
+esp_err_t start_can_update_task(can_transport_kind_t kind, ota_protocol_t protocol, bool page_align);
+
+// Runs run_can_update() or run_uds_update() depending on `protocol`
+esp_err_t run_update(const uint8_t *image, size_t len, can_transport_kind_t kind, ota_protocol_t protocol, bool page_align);
+
+// Runs one complete transfer of `image` over `kind` on the calling task and blocks until it ends.
+// `encoding` is a DATA_ENCODING_*; LZSS falls back to raw if it doesn't make the stream smaller,
+// SPARSE if the image has no constant pages. `page_align` cuts full-frame bursts at flash
+// page ends (see flash_geometry.h); false sends fixed bursts against the same geometry.
+// Returns ESP_OK only if the BMS (real or simulated) confirmed the update. The caller must own the bus.
+esp_err_t run_can_update(const uint8_t *image, size_t len, can_transport_kind_t kind, uint8_t encoding, bool page_align);
+
+// Result of streaming an image as ISO-TP segments
+typedef struct {
+    uint32_t bytes;
+    uint32_t segments;
+    uint32_t frames;       // Frames we sent (FF + CF + SF)
+    uint32_t fc_frames;    // Flow control frames from the receiver (CTS)
+    uint32_t fc_waits;
+    uint32_t elapsed_us;
+    uint32_t goodput_bps;
+    uint32_t received;     // Bytes the simulated receiver reassembled (sim/loopback only)
+} isotp_bench_t;
+
+// Streams `image` in CONFIG_BMS_ISOTP_SEGMENT_LEN segments over `kind` and times it.
+// `block_size`/`st_min` are the flow control the simulated receiver answers with.
+// The caller must own the bus.
+esp_err_t run_isotp_bench(const uint8_t *image, size_t len, can_transport_kind_t kind,
+                          uint8_t block_size, uint8_t st_min, isotp_bench_t *out);
+
+// Adds the session counters in ota_metrics to ota_metrics_total. Called once per transfer.
+void accumulate_metrics(void);
+
+// Takes SYSTEM_IS_BUSY atomically. Returns false if a transfer already owns the bus.
+bool ota_claim_bus(void);
+void ota_release_bus(void);
+
+// Acceptance filter that passes the given 29-bit IDs (and possibly a few neighbours
+// that share their common bits). An empty list gives accept-all.
+twai_filter_config_t can_filter_for_ids(const uint32_t *ids, size_t count);
 
 // Helper to stop driver manually if needed (usually handled internally)
 void stop_can_driver(void);
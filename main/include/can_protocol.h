@@ -0,0 +1,104 @@
+#ifndef CAN_PROTOCOL_H
+#define CAN_PROTOCOL_H
+
+#include <stdint.h>
+
+// Wire format of the BMS bootloader protocol, shared by the transfer engine
+// and the simulated BMS. All frames are 29-bit, 8 data bytes.
+
+// --- IDS ---
+#define ID_HANDSHAKE    0x017B84 // data[0] = 0x01 start handshake, 0x11 reset BMS
+#define ID_START        0x027B84
+#define ID_SIZE         0x037B84 // data[0..1] = bytes that follow in data frames, little endian (16 bits),
+                                 // data[2] = DATA_ENCODING_*, data[3..5] = image length when encoded,
+                                 // data[6] = DATA_FRAMING_*, data[7] = burst frames when framing is FULL
+#define ID_DATA         0x047B84 // data[0..5] = image bytes, data[6..7] = CRC-16 (FULL framing: data[0..7] = image bytes)
+#define ID_VERIFY       0x057B84 // data[0..3] = image CRC-32, data[4..6] = image length (both after decoding)
+#define ID_BMS_RESPONSE 0x067B84
+#define ID_FILL         0x077B84 // data[0..2] = offset, data[3..5] = length, data[6] = value,
+                                 // data[7] = low byte of the CRC-16 of data[0..6]. DATA_ENCODING_SPARSE only.
+#define ID_BURST_CRC    0x087B84 // data[0..1] = CRC-16 of the burst's data frames (all 8 bytes of each),
+                                 // data[2] = frames in the burst. DATA_FRAMING_FULL only, ends every burst.
+
+// --- DATA FRAMES ---
+#define MAX_STREAM_LEN 0xFFFF // The size frame announces the data stream in 16 bits
+#define FRAME_PAYLOAD 6
+#define BURST_FRAMES 2 // Data frames per request/complete cycle
+#define MAX_BURST_FRAMES 16 // Longest burst a BMS may ask for with DATA_FRAMING_FULL
+
+// Layout of the data frames, announced in the size frame. FULL is only used
+// with a BMS that offered BMS_CAP_FULL_FRAMES during the handshake; it then
+// sends BMS_CAPS before its handshake answer.
+#define DATA_FRAMING_LEGACY 0x00 // FRAME_PAYLOAD bytes and a CRC-16 per frame
+#define DATA_FRAMING_FULL   0x01 // FRAME_PAYLOAD_FULL bytes per frame, one ID_BURST_CRC per burst
+#define FRAME_PAYLOAD_FULL 8
+
+#define BMS_CAP_FULL_FRAMES 0x01
+#define BMS_CAP_VERIFY_CRC  0x02 // Answers ID_VERIFY with BMS_VERIFY
+#define BURST_NACK_ALL 0xFF // NACK frame index with FULL framing: the burst CRC failed, resend all of it
+
+// Content of the data frame stream, announced in the size frame. Bootloaders
+// that predate encodings leave data[2..5] unread, so only RAW is safe with them.
+#define DATA_ENCODING_RAW  0x00
+#define DATA_ENCODING_LZSS 0x01 // See lzss.h; the BMS decompresses while writing pages
+#define DATA_ENCODING_SPARSE 0x02 // Raw, but a burst may be one ID_FILL frame instead of data frames
+
+// A fill frame stands in for a whole burst: the BMS writes `length` bytes of
+// `value` from `offset`, which must be its current position, and answers
+// BMS_COMPLETE, or BMS_NACK for frame 0 if the check byte does not match.
+
+// --- SEQUENCE TIMING (gateway side) ---
+// The gateway probes until the BMS answers; together these bound each of
+// the two waits (readiness for the handshake, readiness for the data phase)
+#define INIT_DELAY 5000 // ms
+#define START_DELAY 500 // ms
+
+// --- MESSAGE TABLES ---
+// Every constant of the 0x7B84 family is defined once, here. can_codec.c
+// expands these lists at compile time into constant encoders and lookup-table
+// decoders, so a BMS variant with other magic values is a change to this
+// list only.
+
+// Gateway commands with a constant payload: X(name, id, data[0], data[1]), rest zero
+#define CAN_COMMANDS(X) \
+    X(CMD_START_HANDSHAKE, ID_HANDSHAKE, 0x01, 0x00) \
+    X(CMD_RESET_BMS,       ID_HANDSHAKE, 0x11, 0x00) \
+    X(CMD_START,           ID_START,     0x69, 0x32)
+
+// Every response the engine tells apart: X(name)
+#define BMS_RESPONSE_KINDS(X) \
+    X(BMS_NACK)           /* data[1] = bad frame index in the window, or BURST_NACK_ALL */ \
+    X(BMS_CAPS)           /* data[1] = BMS_CAP_* bits, data[2] = burst frames with FULL framing (0 = BURST_FRAMES) */ \
+    X(BMS_VERIFY)         /* data[1..4] = CRC-32 of the image the BMS assembled */ \
+    X(BMS_UPDATE_ONGOING) \
+    X(BMS_STOP_UPDATE)    \
+    X(BMS_FLASH_BUSY)     /* Page write started, pause */ \
+    X(BMS_FLASH_DONE)     \
+    X(BMS_HANDSHAKE)      \
+    X(BMS_START)          \
+    X(BMS_REQUEST)        /* Send the next burst */ \
+    X(BMS_COMPLETE)       /* Burst received */
+
+// How responses on ID_BMS_RESPONSE are recognised. MARKER(name, data[0]) is
+// checked first; otherwise SUM(name, sum of the 8 data bytes) applies.
+// A name may have several keys, each key must be unique.
+#define BMS_RESPONSES(MARKER, SUM) \
+    MARKER(BMS_NACK,         0x15) \
+    MARKER(BMS_VERIFY,       0xC3) \
+    MARKER(BMS_CAPS,         0xCA) \
+    SUM(BMS_UPDATE_ONGOING,  8)    \
+    SUM(BMS_STOP_UPDATE,     16)   \
+    SUM(BMS_FLASH_BUSY,      24)   \
+    SUM(BMS_FLASH_BUSY,      48)   \
+    SUM(BMS_FLASH_DONE,      32)   \
+    SUM(BMS_HANDSHAKE,       0xFF) \
+    SUM(BMS_START,           290)  \
+    SUM(BMS_REQUEST,         0x88) \
+    SUM(BMS_COMPLETE,        0x90)
+
+#define BMS_RESPONSE_MAX_SUM (8 * 255)
+
+// CRC-16 (XMODEM) over the payload of a data frame
+uint16_t calcrc(uint8_t *ptr, int count);
+
+#endif // CAN_PROTOCOL_H
@@ -0,0 +1,38 @@
+#ifndef CAN_TRANSPORT_H
+#define CAN_TRANSPORT_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "driver/twai.h"
+
+// Where the transfer engine's frames go. Selected per transfer.
+typedef enum {
+    CAN_TRANSPORT_TWAI = 0, // Real BMS on the bus
+    CAN_TRANSPORT_LOOPBACK, // TWAI_MODE_NO_ACK, simulated BMS answers in-process. Measures the controller's frame rate.
+    CAN_TRANSPORT_SIM,      // No hardware at all, simulated BMS only. Measures the engine itself.
+    CAN_TRANSPORT_COUNT
+} can_transport_kind_t;
+
+typedef struct {
+    const char *name;
+    // Takes the controller (if any) for one transfer of `image_len` bytes.
+    // `rx_id` is the peer's response ID, the only one the session needs to hear.
+    esp_err_t (*open)(size_t image_len, uint32_t rx_id);
+    void (*close)(void);
+    esp_err_t (*send)(const twai_message_t *msg, TickType_t timeout);
+    esp_err_t (*recv)(twai_message_t *msg, TickType_t timeout);
+    // Controller alerts. Back-ends without a controller return ESP_ERR_NOT_SUPPORTED.
+    esp_err_t (*read_alerts)(uint32_t *alerts, TickType_t timeout);
+    // Bus-off recovery: blocks until the controller is running again or `timeout` passes
+    esp_err_t (*recover)(TickType_t timeout);
+    esp_err_t (*get_status)(twai_status_info_t *info);
+} can_transport_t;
+
+const can_transport_t *can_transport_get(can_transport_kind_t kind);
+const char *can_transport_name(can_transport_kind_t kind);
+
+// Parses "twai", "loopback" or "sim". Returns false for anything else.
+bool can_transport_from_name(const char *name, can_transport_kind_t *out);
+
+#endif // CAN_TRANSPORT_H
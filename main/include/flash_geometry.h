@@ -0,0 +1,37 @@
+#ifndef FLASH_GEOMETRY_H
+#define FLASH_GEOMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// How the target BMS writes its flash. The bootloader buffers one page and
+// pauses to program it once the page is full, so frames that arrive during
+// that write stall. Bursts that end on page boundaries keep the write
+// between bursts, where the gateway is waiting for the complete anyway.
+
+typedef struct {
+    uint32_t page_bytes; // Program page, 0 = unknown (no page-aligned scheduling)
+    uint32_t write_ms;   // Time to program one page
+    uint32_t align;      // Offset of image byte 0 within its flash page
+} flash_geometry_t;
+
+// Descriptor from menuconfig (BMS_FLASH_*)
+void flash_geometry_config(flash_geometry_t *out);
+
+// A burst can only stop between frames, so page boundaries must fall on
+// multiples of `frame_bytes` from image byte 0 (page size and offset both)
+bool flash_pages_frame_aligned(const flash_geometry_t *g, uint32_t frame_bytes);
+
+// Splits an image of `len` bytes into blocks that each fill one flash page
+// (the first and last may be partial). Writes up to `max` block end offsets,
+// ascending, to `ends` (NULL to only count) and returns how many blocks there are.
+// 0 if the pages are unknown or not aligned to `frame_bytes`: every end but
+// the last is a multiple of it.
+size_t flash_split_pages(const flash_geometry_t *g, uint32_t frame_bytes, size_t len, uint32_t *ends, size_t max);
+
+// End of the block that contains `offset`, `len` if there are no blocks.
+// Binary search over the ends from flash_split_pages().
+uint32_t flash_block_end(const uint32_t *ends, size_t count, uint32_t offset, uint32_t len);
+
+#endif // FLASH_GEOMETRY_H
@@ -0,0 +1,24 @@
+#ifndef FRAME_JITTER_H
+#define FRAME_JITTER_H
+
+#include <stdint.h>
+
+#define FRAME_JITTER_SAMPLES 256
+
+typedef struct {
+    uint32_t samples;
+    uint32_t p50_us;
+    uint32_t p90_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} frame_jitter_report_t;
+
+// Records the gap between two consecutive data frames of one burst.
+// Called from the CAN task; keeps the last FRAME_JITTER_SAMPLES gaps.
+void frame_jitter_record(uint32_t gap_us);
+void frame_jitter_reset(void);
+
+// Percentiles over the recorded window (sorts a copy, call from httpd)
+void frame_jitter_report(frame_jitter_report_t *out);
+
+#endif // FRAME_JITTER_H
@@ -0,0 +1,46 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define IMAGE_CACHE_MAX_SLOTS 8
+#define IMAGE_HASH_LEN 32 // SHA-256
+#define IMAGE_LABEL_LEN 24
+
+typedef struct {
+    uint8_t hash[IMAGE_HASH_LEN];
+    uint32_t size;
+    uint32_t last_use; // Use sequence number, higher = more recent
+    char label[IMAGE_LABEL_LEN];
+} image_cache_entry_t;
+
+// Finds the "imgcache" partition and loads the index from NVS. Call after nvs_flash_init().
+esp_err_t image_cache_init(void);
+
+// SHA-256 of an image, the cache key
+void image_hash(const uint8_t *image, size_t len, uint8_t out[IMAGE_HASH_LEN]);
+
+// Writes an image to flash (or just marks it used if the hash is already cached).
+// Evicts the least recently used unpinned image when the budget is full.
+// Erasing stalls both cores' flash cache: never call while a transfer owns the bus.
+esp_err_t image_cache_store(const uint8_t *image, size_t len, const char *label, uint8_t out_hash[IMAGE_HASH_LEN]);
+
+// Returns ESP_ERR_NOT_FOUND if the hash is not cached
+esp_err_t image_cache_lookup(const uint8_t hash[IMAGE_HASH_LEN], image_cache_entry_t *out);
+
+// Maps a cached image into the address space for reading; no copy to RAM.
+// The image cannot be evicted until image_cache_release() is called.
+esp_err_t image_cache_acquire(const uint8_t hash[IMAGE_HASH_LEN], const uint8_t **image, size_t *len);
+void image_cache_release(const uint8_t hash[IMAGE_HASH_LEN]);
+
+// Copies up to `max` cached entries, most recently used first. Returns the number copied.
+size_t image_cache_list(image_cache_entry_t *out, size_t max);
+
+// Hex helpers for URLs and JSON (out needs IMAGE_HASH_LEN * 2 + 1 bytes)
+void image_hash_to_hex(const uint8_t hash[IMAGE_HASH_LEN], char *out);
+bool image_hash_from_hex(const char *hex, uint8_t hash[IMAGE_HASH_LEN]);
+
+#endif // IMAGE_CACHE_H
@@ -0,0 +1,45 @@
+#ifndef ISOTP_H
+#define ISOTP_H
+
+#include <esp_err.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "can_transport.h"
+
+// ISO 15765-2 (ISO-TP) segmentation over any can_transport_t.
+// Normal addressing, 8-byte frames padded with ISOTP_PADDING. Messages above
+// 4095 bytes use the 32-bit first frame length of ISO 15765-2:2016.
+
+#define ISOTP_PADDING 0xCC
+#define ISOTP_N_BS_TIMEOUT 1000 // ms to wait for a flow control frame
+#define ISOTP_N_CR_TIMEOUT 1000 // ms to wait for the next consecutive frame
+#define ISOTP_MAX_WAIT_FRAMES 10 // N_WFTmax: FC.WAIT frames accepted in a row
+
+typedef struct {
+    const can_transport_t *transport;
+    uint32_t tx_id;      // Our requests
+    uint32_t rx_id;      // Peer's responses and flow control
+    uint8_t rx_block_size; // BS and STmin we advertise when receiving
+    uint8_t rx_st_min;
+
+    // Counters since the link was set up
+    uint32_t frames_sent;
+    uint32_t fc_received;  // Flow control frames that let us continue (CTS)
+    uint32_t fc_waits;     // FC.WAIT frames
+    uint32_t st_min_us;    // Separation time last requested by the peer
+} isotp_link_t;
+
+void isotp_link_init(isotp_link_t *link, const can_transport_t *transport, uint32_t tx_id, uint32_t rx_id);
+
+// Sends one message, honouring the peer's block size and STmin.
+// ESP_ERR_TIMEOUT if flow control does not arrive, ESP_ERR_INVALID_SIZE on FC.OVFLW.
+esp_err_t isotp_send(isotp_link_t *link, const uint8_t *data, size_t len);
+
+// Receives one message into `buf`, sending our own flow control for multi-frame messages.
+// ESP_ERR_INVALID_SIZE (after sending FC.OVFLW) if it does not fit.
+esp_err_t isotp_receive(isotp_link_t *link, uint8_t *buf, size_t size, size_t *out_len, TickType_t timeout);
+
+// STmin byte to microseconds: 0x00-0x7F ms, 0xF1-0xF9 100-900 us, reserved values as 127 ms
+uint32_t isotp_st_min_us(uint8_t st_min);
+
+#endif // ISOTP_H
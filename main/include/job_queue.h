@@ -0,0 +1,58 @@
+#ifndef JOB_QUEUE_H
+#define JOB_QUEUE_H
+
+#include <esp_err.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "image_cache.h"
+#include "can_manager.h"
+
+#define JOB_QUEUE_LEN 4
+#define JOB_TARGET_LEN 24
+
+typedef enum {
+    JOB_EMPTY,
+    JOB_QUEUED,
+    JOB_FLASHING,
+    JOB_DONE,
+    JOB_FAILED
+} job_state_t;
+
+// Copy of a job slot, safe to read outside the queue lock
+typedef struct {
+    uint32_t id;
+    job_state_t state;
+    size_t size;
+    bool cached; // Image is read straight from the flash image cache
+    can_transport_kind_t transport;
+    ota_protocol_t protocol;
+    bool page_align; // Full-frame bursts cut at flash page ends (run_can_update)
+    char target[JOB_TARGET_LEN];
+    char result[32];
+} job_info_t;
+
+// Starts the background task that flashes queued jobs back to back (Core 1)
+esp_err_t start_job_scheduler(void);
+
+// Queues a staged image. The queue takes ownership of `image` (malloc'd) in all cases.
+// With a `cache_label`, the scheduler also stores the image in the flash image
+// cache once it holds the bus, before flashing, so no erase overlaps a transfer.
+// Returns ESP_ERR_NO_MEM if every slot holds a queued or running job.
+esp_err_t job_queue_add(uint8_t *image, size_t len, const char *target, can_transport_kind_t transport,
+                        ota_protocol_t protocol, bool page_align, const char *cache_label, uint32_t *out_id);
+
+// Queues an image already held in the flash image cache. No RAM copy is made;
+// the image is mapped only while it is being flashed.
+esp_err_t job_queue_add_cached(const uint8_t hash[IMAGE_HASH_LEN], size_t len, const char *target,
+                               can_transport_kind_t transport, ota_protocol_t protocol, bool page_align, uint32_t *out_id);
+
+// Removes a job and frees its image. A job that is flashing cannot be removed.
+esp_err_t job_queue_remove(uint32_t id);
+
+// Copies up to `max` non-empty slots, oldest first. Returns the number copied.
+size_t job_queue_list(job_info_t *out, size_t max);
+
+const char *job_state_name(job_state_t state);
+
+#endif // JOB_QUEUE_H
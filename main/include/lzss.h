@@ -0,0 +1,51 @@
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Byte-aligned LZSS used for DATA_ENCODING_LZSS transfers.
+//
+// Stream: a flag byte, then up to 8 items, repeated. Flag bit i (LSB first)
+// set means item i is a match, clear means a literal byte.
+//   literal: 1 byte, copied to the output
+//   match:   2 bytes, distance - 1 (1..256 back) and length - 3 (3..258)
+// A match may overlap the bytes it produces (distance 1 = run of one byte).
+//
+// This file is plain C99 with no ESP-IDF dependencies: lzss_decoder_t and
+// lzss_decode() are the reference for the BMS bootloader side.
+
+#define LZSS_WINDOW 256
+#define LZSS_MIN_MATCH 3
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + 255)
+
+// Worst case output size (no matches at all)
+#define LZSS_BOUND(len) ((len) + ((len) + 7) / 8)
+
+// Compresses `len` bytes into `out`. Returns the compressed length, or 0 if
+// it would not fit in `out_cap` (callers pass len - 1 to insist on a gain).
+size_t lzss_encode(const uint8_t *in, size_t len, uint8_t *out, size_t out_cap);
+
+// --- REFERENCE DECODER ---
+// Streaming: compressed bytes can be fed in any split (e.g. 6 per CAN frame).
+// State is LZSS_WINDOW + 4 bytes; nothing is allocated.
+
+typedef void (*lzss_sink_t)(void *ctx, uint8_t byte);
+
+typedef struct {
+    uint8_t window[LZSS_WINDOW]; // Last 256 output bytes, ring indexed by `pos`
+    uint8_t pos;
+    uint8_t flags;       // Flag byte of the current group, shifted as items are read
+    uint8_t items_left;  // Items left in the group, 0 = next byte is a flag byte
+    uint8_t distance;    // Set while the second byte of a match is awaited
+    bool in_match;
+} lzss_decoder_t;
+
+void lzss_decoder_init(lzss_decoder_t *d);
+
+// Decodes `len` compressed bytes, handing every output byte to `sink`.
+// Returns the number of bytes produced.
+size_t lzss_decode(lzss_decoder_t *d, const uint8_t *in, size_t len, lzss_sink_t sink, void *ctx);
+
+#endif // LZSS_H
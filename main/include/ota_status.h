@@ -0,0 +1,73 @@
+#ifndef OTA_STATUS_H
+#define OTA_STATUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    OTA_STATE_IDLE,
+    OTA_STATE_INITIALIZING,
+    OTA_STATE_HANDSHAKE_OK,
+    OTA_STATE_FLASHING,
+    OTA_STATE_VERIFYING,
+    OTA_STATE_SUCCESS,
+    OTA_STATE_FAILED
+} ota_state_t;
+
+// What the CAN task is doing right now, finer grained than the state
+typedef enum {
+    OTA_PHASE_IDLE,
+    OTA_PHASE_HANDSHAKE,
+    OTA_PHASE_SENDING,     // Transmitting a burst
+    OTA_PHASE_WAIT_ACK,    // Burst sent, waiting for the BMS
+    OTA_PHASE_FLASH_PAUSE, // BMS reported a page write in progress
+    OTA_PHASE_VERIFY
+} ota_phase_t;
+
+// Reason for OTA_STATE_FAILED. Values are part of the /api/status "code" field, append only.
+typedef enum {
+    OTA_ERR_NONE = 0,
+    OTA_ERR_RETRY_LIMIT = 1,
+    OTA_ERR_VERIFY_MISMATCH = 2,
+    OTA_ERR_VERIFY_TIMEOUT = 3,
+    OTA_ERR_BUS_OFF = 4,
+    OTA_ERR_BMS_TIMEOUT = 5,
+    OTA_ERR_TRANSPORT = 6,
+    OTA_ERR_UDS_REJECTED = 7,
+    OTA_ERR_IMAGE_TOO_LARGE = 8 // Data stream does not fit the 16-bit size frame
+} ota_error_t;
+
+typedef struct {
+    bool busy;
+    ota_state_t state;
+    ota_error_t error;
+    uint32_t sent;
+    uint32_t total;
+    uint32_t retries;
+    uint32_t retransmit_bytes;
+    uint8_t transport;       // can_transport_kind_t of the session
+    uint8_t protocol;        // ota_protocol_t of the session
+
+    // Live telemetry, exponentially weighted moving averages
+    ota_phase_t phase;
+    uint32_t goodput_bps;    // Image bytes per second
+    uint32_t frame_rate;     // Data frames per second
+    uint32_t burst_rtt_us;   // First frame of a burst to the BMS complete message
+    uint32_t flash_pause_us; // BMS page write pause
+    uint32_t eta_s;          // Remaining bytes at the current goodput
+} ota_status_t;
+
+// Single writer (the CAN task). Never blocks; copies the record into the inactive buffer and flips.
+void ota_status_publish(const ota_status_t *status);
+
+// Any number of readers on either core. Returns a consistent copy without blocking the writer.
+void ota_status_read(ota_status_t *out);
+
+const char *ota_state_name(ota_state_t state);
+const char *ota_error_name(ota_error_t error);
+const char *ota_phase_name(ota_phase_t phase);
+
+// Error name for a failed session, state name otherwise
+const char *ota_status_text(const ota_status_t *status);
+
+#endif // OTA_STATUS_H
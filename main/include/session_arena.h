@@ -0,0 +1,52 @@
+#ifndef SESSION_ARENA_H
+#define SESSION_ARENA_H
+
+#include <esp_err.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// One block of RAM reserved at boot for everything an upload and a transfer
+// need, so images of varying size never fragment the heap. It holds two
+// staging slots, one at each end, and the scratch area:
+//
+//   [ active slot | scratch ->         free         <- next slot ]
+//
+// (mirrored when the active slot is the one at the top). The active slot
+// holds the image that /api/flash sends. Uploads always go to the next slot
+// (the image and a chunked upload's bitmap), so one can be received while the
+// active image is on the bus. session_arena_stage_swap() makes the next slot
+// active once no transfer is reading the old one. Scratch holds per-transfer
+// data (compressed stream, fill runs, UDS blocks), grows from the active slot
+// towards the next one, and is reset when a transfer starts. Everything is a
+// bump allocator: nothing is freed, a reset is O(1). The slots belong to the
+// staging_lock holder, scratch to the task that owns the bus.
+
+typedef struct {
+    uint32_t size;
+    uint32_t stage_used;        // Active slot
+    uint32_t next_used;         // Next slot
+    uint32_t scratch_used;
+    uint32_t scratch_peak;      // Most scratch one transfer has used
+    uint32_t failures;          // Allocations that did not fit
+    uint32_t heap_free;
+    uint32_t heap_min_free;     // Lowest free heap since boot
+    uint32_t largest_block;     // Largest block malloc could return right now
+    uint32_t largest_block_min; // Lowest of the above, sampled at every reset and read
+} session_arena_stats_t;
+
+// Reserves CONFIG_BMS_SESSION_ARENA_KB. Call once, early, before WiFi and httpd fragment the heap.
+esp_err_t session_arena_init(void);
+
+// Next slot. 4-byte aligned; NULL if it would meet scratch.
+void *session_arena_stage_alloc(size_t len);
+void session_arena_stage_reset(void);
+// Makes the next slot active and empties the old active slot, which becomes
+// the next one. Resets scratch, so only call while no transfer runs.
+void session_arena_stage_swap(void);
+
+void *session_arena_scratch_alloc(size_t len);
+void session_arena_scratch_reset(void);
+
+void session_arena_stats(session_arena_stats_t *out);
+
+#endif // SESSION_ARENA_H
@@ -0,0 +1,49 @@
+#ifndef SIM_BMS_H
+#define SIM_BMS_H
+
+#include <esp_err.h>
+#include <stddef.h>
+#include "driver/twai.h"
+#include "can_protocol.h"
+
+// In-process stand-in for the BMS bootloader. It answers the gateway's frames
+// with the same responses a pack would send, without any delay, so the
+// loopback and simulation transports can run a full transfer with no pack.
+
+// Resets the simulated BMS for a transfer of `image_len` bytes
+esp_err_t sim_bms_start(size_t image_len);
+void sim_bms_stop(void);
+
+// Feeds one frame sent by the gateway. Replies are queued for sim_bms_receive().
+void sim_bms_on_frame(const twai_message_t *msg);
+
+// Returns the next queued reply, ESP_ERR_TIMEOUT if there is none
+esp_err_t sim_bms_receive(twai_message_t *msg, TickType_t timeout);
+
+// ISO-TP receiver on CONFIG_BMS_ISOTP_REQUEST_ID, with a minimal UDS download
+// server behind it. Sets the flow control it answers with, to emulate how a
+// real bootloader paces the gateway.
+void sim_bms_set_isotp_flow(uint8_t block_size, uint8_t st_min);
+
+// Capabilities offered in BMS_CAPS before the handshake answer (BMS_CAP_* bits
+// and preferred burst length). 0 emulates a bootloader that predates them.
+#define SIM_BMS_CAPS (BMS_CAP_FULL_FRAMES | BMS_CAP_VERIFY_CRC)
+#define SIM_BMS_BURST 8
+void sim_bms_set_caps(uint8_t caps, uint8_t burst);
+
+// The simulated BMS programs its flash like the BMS_FLASH_* geometry in
+// menuconfig: pages fill as data arrives, each takes write_ms, and replies
+// wait for the write.
+typedef struct {
+    uint32_t pages;        // Page writes
+    uint32_t stalls;       // Data frames that arrived during a page write
+    uint32_t busy_replies; // FLASH_BUSY answers sent
+} sim_bms_flash_stats_t;
+
+// Flash counters since sim_bms_start()
+void sim_bms_flash_stats(sim_bms_flash_stats_t *out);
+
+// Payload bytes of complete ISO-TP messages reassembled since sim_bms_start()
+uint32_t sim_bms_isotp_bytes(void);
+
+#endif // SIM_BMS_H
@@ -0,0 +1,35 @@
+#ifndef SPARSE_IMAGE_H
+#define SPARSE_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Finds the parts of an image that are one byte value repeated (erased
+// flash, zero fill), so DATA_ENCODING_SPARSE transfers can send them as a
+// single fill frame instead of data frames.
+//
+// Plain C99 with no ESP-IDF dependencies, like lzss.c.
+
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+    uint8_t value;
+} fill_run_t;
+
+// Finds runs of whole `page` aligned pages that hold a single byte value.
+// A partial last page counts as a page. Neighbouring pages of the same
+// value merge into one run. Writes up to `max` runs, in image order, to
+// `runs` (NULL to only count) and returns how many there are.
+size_t sparse_find_runs(const uint8_t *image, size_t len, size_t page, fill_run_t *runs, size_t max);
+
+// Run that contains `offset`, NULL if none. Binary search over sorted runs.
+const fill_run_t *sparse_run_at(const fill_run_t *runs, size_t count, uint32_t offset);
+
+// Frames on the bus for a legacy transfer of `len` bytes, with the BMS
+// request and complete of every burst. Walks the image the way the engine
+// does: a burst starting inside a run is one fill frame up to the end of the
+// run, any other burst is up to `burst_frames` data frames. With no runs
+// this is the raw transfer.
+uint32_t sparse_count_frames(size_t len, const fill_run_t *runs, size_t count, uint32_t burst_frames);
+
+#endif // SPARSE_IMAGE_H
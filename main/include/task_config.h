@@ -0,0 +1,45 @@
+#ifndef TASK_CONFIG_H
+#define TASK_CONFIG_H
+
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+// --- TASK LAYOUT ---
+// Core 0: WiFi, lwIP, httpd, main
+// Core 1: everything that touches the TWAI driver
+//
+// Only one CAN owner runs at a time (see ota_claim_bus), so the transfer
+// task and the job scheduler share a priority. Capture sits just below the
+// transfer so a capture started mid-session never preempts it.
+
+#if CONFIG_BMS_LOW_LATENCY_CAN
+// Above lwIP (18) and every other app task on core 1, below the IPC/timer tasks
+#define CAN_TASK_PRIORITY     20
+#define CAPTURE_TASK_PRIORITY 19
+#define HTTPD_TASK_PRIORITY   5
+#define HTTPD_TASK_CORE       0
+
+// Keeps the per-frame path out of flash so cache misses during WiFi
+// activity don't stall frame timing
+#define CAN_HOT_ATTR IRAM_ATTR
+#define CAN_HOT_DATA DRAM_ATTR
+#else
+#define CAN_TASK_PRIORITY     5
+#define CAPTURE_TASK_PRIORITY 10
+#define HTTPD_TASK_PRIORITY   5
+#define HTTPD_TASK_CORE       tskNO_AFFINITY
+
+#define CAN_HOT_ATTR
+#define CAN_HOT_DATA
+#endif
+
+#define CAN_TASK_CORE        1
+#define CAN_TASK_STACK       4096
+#define CAPTURE_TASK_STACK   3072
+
+// Long HTTP requests (uploads, capture streams, benchmarks) run on these
+// instead of the httpd task, at the same priority and core
+#define HTTPD_ASYNC_WORKERS  2
+#define HTTPD_WORKER_STACK   6144
+
+#endif // TASK_CONFIG_H
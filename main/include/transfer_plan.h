@@ -0,0 +1,64 @@
+#ifndef TRANSFER_PLAN_H
+#define TRANSFER_PLAN_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "app_shared.h"
+#include "can_transport.h"
+
+// Timing model of a legacy transfer, for answering "how long will this take"
+// without touching the bus. Calibrated from finished sessions, per transport.
+
+#define PLAN_DEFAULT_BITRATE 250000
+
+// BMS behaviour learned from past sessions (or given as what-if overrides)
+typedef struct {
+    uint32_t sessions;       // Sessions folded in, 0 = defaults only
+    uint32_t handshake_ms;   // Whole handshake, probing until the BMS is ready
+    uint32_t turnaround_us;  // Per burst, cycle time minus bus airtime
+    uint32_t page_bytes;     // Image bytes between flash pauses, 0 = no pauses seen
+    uint32_t page_write_ms;  // Length of one flash pause
+    uint32_t retx_permille;  // Retransmitted bytes per 1000 image bytes
+} plan_calibration_t;
+
+typedef struct {
+    uint32_t image_len;
+    uint32_t bitrate;
+    uint32_t burst_frames;
+    uint8_t framing;         // DATA_FRAMING_*: FULL carries 8 bytes per frame and a CRC frame per burst
+    plan_calibration_t bms;
+} plan_params_t;
+
+typedef struct {
+    uint32_t frame_us;        // One 29-bit, 8 byte frame without stuff bits
+    uint32_t frame_worst_us;  // Same with worst-case bit stuffing
+    uint32_t bursts;
+    uint32_t handshake_ms;
+    uint32_t airtime_ms;      // Request, data and complete frames (no stuffing)
+    uint32_t airtime_worst_ms;
+    uint32_t turnaround_ms;
+    uint32_t flash_ms;
+    uint32_t retx_ms;
+    uint32_t verify_ms;
+    uint32_t total_ms;
+    uint32_t total_worst_ms;  // With worst-case stuffing on every frame
+} plan_estimate_t;
+
+// Loads the saved calibration from NVS. Call after nvs_flash_init().
+esp_err_t transfer_plan_init(void);
+
+// Bits on the wire for one data frame, including stuff bits when `worst`,
+// intermission included
+uint32_t can_frame_bits(uint8_t dlc, bool extended, bool worst);
+
+// Fills p->bms with the calibration of `kind`, or defaults if none yet
+void transfer_plan_params(can_transport_kind_t kind, size_t image_len, plan_params_t *p);
+
+void transfer_plan_estimate(const plan_params_t *p, plan_estimate_t *out);
+
+// Folds the metrics of a successful legacy session into the calibration of `kind`
+void transfer_plan_calibrate(can_transport_kind_t kind, size_t image_len, volatile const ota_metrics_t *m);
+
+#endif // TRANSFER_PLAN_H
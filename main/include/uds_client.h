@@ -0,0 +1,18 @@
+#ifndef UDS_CLIENT_H
+#define UDS_CLIENT_H
+
+#include <esp_err.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "can_transport.h"
+
+// ISO 14229 download client over ISO-TP, for BMS units with a UDS bootloader.
+// Sequence: programming session, erase routine, RequestDownload, TransferData
+// blocks of the ECU's maxNumberOfBlockLength, RequestTransferExit, CRC-32
+// check routine, ECU reset.
+
+// Runs one complete download of `image` over `kind` on the calling task and
+// publishes progress like run_can_update(). The caller must own the bus.
+esp_err_t run_uds_update(const uint8_t *image, size_t len, can_transport_kind_t kind);
+
+#endif // UDS_CLIENT_H
@@ -0,0 +1,55 @@
+#ifndef UPLOAD_SESSION_H
+#define UPLOAD_SESSION_H
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "image_cache.h"
+
+// Chunked, resumable upload into a RAM staging buffer. One session at a time;
+// chunks may arrive in any order and over several connections at once.
+#define UPLOAD_CHUNK_DEFAULT 4096
+#define UPLOAD_CHUNK_MIN 512
+#define UPLOAD_CHUNK_MAX 32768
+
+typedef struct {
+    uint32_t id;          // 0 = no session
+    uint32_t size;        // Image bytes
+    uint32_t chunk_len;
+    uint32_t chunks;
+    uint32_t received;    // Chunks written
+    uint32_t in_flight;   // Chunks being written right now
+} upload_session_info_t;
+
+esp_err_t upload_session_init(void);
+
+// Allocates the staging buffer from the stage end of the session arena and
+// drops any previous session. Reset the stage end first.
+// ESP_ERR_INVALID_STATE while chunks of the previous session are in flight.
+// ESP_ERR_NO_MEM if the image does not fit the arena.
+esp_err_t upload_session_open(size_t size, size_t chunk_len, uint32_t *out_id);
+
+// Claims the chunk starting at `start`. It must be chunk aligned and `len` must
+// be the whole chunk (shorter only for the last one). On success *dst points
+// into the staging buffer and upload_session_end_chunk() must follow.
+// A chunk that was already received can be sent again.
+esp_err_t upload_session_begin_chunk(uint32_t id, size_t start, size_t len, uint8_t **dst);
+void upload_session_end_chunk(uint32_t id, size_t start, bool ok);
+
+void upload_session_get(upload_session_info_t *out);
+
+// Copies up to `max` missing chunk indexes, lowest first. Returns the number copied.
+size_t upload_session_missing(uint32_t *out, size_t max);
+
+// Checks that every chunk arrived and the SHA-256 matches, then hands the buffer
+// to the caller and closes the session. The buffer stays valid until the stage
+// end of the session arena is reset. On a digest mismatch the
+// session stays open with every chunk marked missing.
+// ESP_ERR_INVALID_STATE: chunks missing or in flight. ESP_ERR_INVALID_CRC: digest mismatch.
+esp_err_t upload_session_finish(uint32_t id, const uint8_t sha256[IMAGE_HASH_LEN], uint8_t **image, size_t *len);
+
+// Drops the session. ESP_ERR_INVALID_STATE (and nothing dropped) while chunks are in flight.
+esp_err_t upload_session_abort(void);
+
+#endif // UPLOAD_SESSION_H
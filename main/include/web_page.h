@@ -66,12 +66,30 @@ const char* index_html =
                 "<span>System: <span id='sysState' class='highlight'>Idle</span></span>"
                 "<span>Progress: <span id='sentBytes'>0</span> / <span id='totalBytes'>0</span></span>"
             "</div>"
+            "<div class='status-row'>"
+                "<span>Retries: <span id='retries'>0</span></span>"
+                "<span>Retransmitted: <span id='retxBytes'>0</span> bytes</span>"
+            "</div>"
+            "<div class='status-row'>"
+                "<span>Speed: <span id='goodput' class='highlight'>0</span> B/s (<span id='frameRate'>0</span> fr/s)</span>"
+                "<span>ETA: <span id='eta'>-</span></span>"
+            "</div>"
+            "<div class='status-row'>"
+                "<span>Phase: <span id='phase'>idle</span></span>"
+                "<span>RTT: <span id='rtt'>0</span> ms | Flash: <span id='flashPause'>0</span> ms</span>"
+            "</div>"
+            "<div class='status-row'>"
+                "<span>Status latency: p50 <span id='latP50'>-</span> ms | p99 <span id='latP99'>-</span> ms</span>"
+            "</div>"
         "</div>"
     "</div>"
 
     "<script>"
         "let isFlashing = false;"
         "let pollInterval = null;"
+        "let uploadPoll = null;"
+        "let nextQueued = 0;" // Size of an upload made during a flash, flashable when it ends
+        "let latencies = [];" // Last 200 /api/status round trips in ms
         
         // --- FILE READER LOGIC ---
         "document.getElementById('fileInput').addEventListener('change', function(e) {"
@@ -102,31 +120,52 @@ const char* index_html =
             
             "document.getElementById('uploadBtn').disabled = true;"
             "document.getElementById('uploadStatus').innerText = 'Uploading...';"
+            "latencies = [];"
+            "uploadPoll = setInterval(pollStatus, 250);" // Status must stay responsive during the upload
             
             "fetch('/api/upload', { method: 'POST', body: hex })"
             ".then(r => { if(r.ok) return r.json(); throw new Error(r.statusText); })"
             ".then(d => {"
+                "stopUploadPoll();"
+                "document.getElementById('uploadBtn').disabled = false;"
+                "if(d.queued) {"
+                    "nextQueued = d.size;"
+                    "document.getElementById('uploadStatus').innerText = 'Queued for next unit';"
+                    "alert('Firmware loaded. It will be flashable when the current update ends.');"
+                    "return;"
+                "}"
                 "document.getElementById('uploadStatus').innerText = 'Verified';"
                 "document.getElementById('ramSize').innerText = d.size;"
                 "document.getElementById('flashBtn').disabled = false;"
-                "document.getElementById('uploadBtn').disabled = false;"
                 "document.getElementById('totalBytes').innerText = d.size;"
                 "alert('Firmware loaded into RAM successfully.');"
             "}).catch(e => {"
+                "stopUploadPoll();"
                 "document.getElementById('uploadStatus').innerText = 'Error';"
                 "document.getElementById('uploadBtn').disabled = false;"
                 "alert('Upload Failed: ' + e);"
             "});"
         "}"
 
+        "function stopUploadPoll() {"
+            "if(uploadPoll) clearInterval(uploadPoll);"
+            "uploadPoll = null;"
+        "}"
+
+        "function recordLatency(ms) {"
+            "latencies.push(ms);"
+            "if(latencies.length > 200) latencies.shift();"
+            "let s = latencies.slice().sort((a, b) => a - b);"
+            "let pick = q => s[Math.min(s.length - 1, Math.floor(q * s.length))].toFixed(1);"
+            "document.getElementById('latP50').innerText = pick(0.5);"
+            "document.getElementById('latP99').innerText = pick(0.99);"
+        "}"
+
         "function startFlash() {"
             "if(!confirm('Start BMS Update? Do not power off.')) return;"
             
             "isFlashing = true;"
-            "document.getElementById('flashBtn').disabled = true;"
-            "document.getElementById('uploadBtn').disabled = true;"
-            "document.getElementById('hexInput').disabled = true;"
-            "document.getElementById('fileInput').disabled = true;" // Disable file input too
+            "document.getElementById('flashBtn').disabled = true;" // Uploads stay open: they go to the next slot
             "document.getElementById('sysState').innerText = 'Starting...';"
             
             "fetch('/api/flash', { method: 'POST' })"
@@ -138,19 +177,25 @@ const char* index_html =
                 "alert('Could not start flash: ' + e);"
                 "isFlashing = false;"
                 "document.getElementById('flashBtn').disabled = false;"
-                "document.getElementById('uploadBtn').disabled = false;"
-                "document.getElementById('hexInput').disabled = false;"
-                "document.getElementById('fileInput').disabled = false;"
             "});"
         "}"
 
         "function pollStatus() {"
+            "let t0 = performance.now();"
             "fetch('/api/status')"
-            ".then(r => r.json())"
+            ".then(r => { recordLatency(performance.now() - t0); return r.json(); })"
             ".then(d => {"
-                "document.getElementById('sysState').innerText = d.status;"
+                "document.getElementById('sysState').innerText = d.code ? d.state + ': ' + d.error : d.state;"
                 "document.getElementById('sentBytes').innerText = d.sent;"
                 "document.getElementById('totalBytes').innerText = d.total;"
+                "document.getElementById('retries').innerText = d.retries;"
+                "document.getElementById('retxBytes').innerText = d.retx_bytes;"
+                "document.getElementById('goodput').innerText = d.goodput_bps;"
+                "document.getElementById('frameRate').innerText = d.frames_per_s;"
+                "document.getElementById('eta').innerText = d.busy && d.eta_s ? Math.floor(d.eta_s / 60) + 'm ' + (d.eta_s % 60) + 's' : '-';"
+                "document.getElementById('phase').innerText = d.phase;"
+                "document.getElementById('rtt').innerText = (d.burst_rtt_us / 1000).toFixed(1);"
+                "document.getElementById('flashPause').innerText = (d.flash_pause_us / 1000).toFixed(1);"
                 
                 "let pct = 0;"
                 "if(d.total > 0) pct = Math.round((d.sent / d.total) * 100);"
@@ -162,13 +207,15 @@ const char* index_html =
                 "if (d.busy === false && isFlashing) {"
                     "clearInterval(pollInterval);"
                     "isFlashing = false;"
-                    "document.getElementById('uploadBtn').disabled = false;"
-                    "document.getElementById('hexInput').disabled = false;"
-                    "document.getElementById('fileInput').disabled = false;"
-                    "document.getElementById('flashBtn').disabled = true;"
+                    "document.getElementById('flashBtn').disabled = !nextQueued;"
+                    "if(nextQueued) {"
+                        "document.getElementById('uploadStatus').innerText = 'Verified';"
+                        "document.getElementById('ramSize').innerText = nextQueued;"
+                    "}"
+                    "nextQueued = 0;"
                     
-                    "if(d.status.includes('Success')) alert('Update Complete Successfully!');"
-                    "else alert('Update Failed: ' + d.status);"
+                    "if(d.state === 'Success') alert('Update Complete Successfully!');"
+                    "else alert('Update Failed: ' + (d.error || d.state));"
                 "}"
             "}).catch(e => console.log('Poll error', e));"
         "}"
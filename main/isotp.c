@@ -0,0 +1,220 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "isotp.h"
+
+static const char *TAG = "ISOTP";
+
+// --- PCI ---
+#define PCI_SF 0x00
+#define PCI_FF 0x10
+#define PCI_CF 0x20
+#define PCI_FC 0x30
+#define FC_CTS 0
+#define FC_WAIT 1
+#define FC_OVFLW 2
+
+#define SF_MAX 7
+#define FF_MAX_12BIT 4095
+#define CF_PAYLOAD 7
+
+// Worst-case 29-bit, 8-byte frame at 250 kbit/s including bit stuffing.
+// twai_transmit() returns when the frame is queued, not when it leaves, so
+// STmin is counted from the end of the previous frame's airtime.
+#define FRAME_AIRTIME_US 640
+
+void isotp_link_init(isotp_link_t *link, const can_transport_t *transport, uint32_t tx_id, uint32_t rx_id) {
+    memset(link, 0, sizeof(*link));
+    link->transport = transport;
+    link->tx_id = tx_id;
+    link->rx_id = rx_id;
+}
+
+uint32_t isotp_st_min_us(uint8_t st_min) {
+    if (st_min <= 0x7F) return st_min * 1000;
+    if (st_min >= 0xF1 && st_min <= 0xF9) return (st_min - 0xF0) * 100;
+    return 0x7F * 1000;
+}
+
+// Sleeps whole ticks while the deadline is far away, then spins for the rest
+static void wait_until(int64_t deadline_us) {
+    int64_t remaining_ms = (deadline_us - esp_timer_get_time()) / 1000;
+    if (remaining_ms > 2 * portTICK_PERIOD_MS) vTaskDelay(remaining_ms / portTICK_PERIOD_MS - 1);
+    while (esp_timer_get_time() < deadline_us) {}
+}
+
+static esp_err_t send_frame(isotp_link_t *link, const uint8_t *data, size_t len) {
+    twai_message_t msg = { .extd = link->tx_id > 0x7FF, .identifier = link->tx_id, .data_length_code = 8 };
+    memset(msg.data, ISOTP_PADDING, 8);
+    memcpy(msg.data, data, len);
+    esp_err_t err = link->transport->send(&msg, pdMS_TO_TICKS(100));
+    if (err == ESP_OK) link->frames_sent++;
+    return err;
+}
+
+static esp_err_t send_flow_control(isotp_link_t *link, uint8_t status) {
+    uint8_t fc[3] = { PCI_FC | status, link->rx_block_size, link->rx_st_min };
+    return send_frame(link, fc, sizeof(fc));
+}
+
+// Next frame from the peer, skipping everything else on the bus
+static esp_err_t recv_frame(isotp_link_t *link, twai_message_t *msg, TickType_t timeout) {
+    TickType_t start = xTaskGetTickCount();
+    do {
+        if (link->transport->recv(msg, pdMS_TO_TICKS(10)) == ESP_OK && msg->identifier == link->rx_id) return ESP_OK;
+    } while ((xTaskGetTickCount() - start) < timeout);
+    return ESP_ERR_TIMEOUT;
+}
+
+static esp_err_t wait_flow_control(isotp_link_t *link, uint8_t *block_size, uint32_t *st_min_us) {
+    twai_message_t msg;
+    uint8_t waits = 0;
+    while (recv_frame(link, &msg, pdMS_TO_TICKS(ISOTP_N_BS_TIMEOUT)) == ESP_OK) {
+        if ((msg.data[0] & 0xF0) != PCI_FC) continue;
+
+        switch (msg.data[0] & 0x0F) {
+            case FC_CTS:
+                *block_size = msg.data[1];
+                *st_min_us = isotp_st_min_us(msg.data[2]);
+                link->st_min_us = *st_min_us;
+                link->fc_received++;
+                return ESP_OK;
+            case FC_WAIT:
+                link->fc_waits++;
+                if (++waits > ISOTP_MAX_WAIT_FRAMES) {
+                    ESP_LOGE(TAG, "Peer sent %d FC.WAIT in a row", waits);
+                    return ESP_ERR_TIMEOUT;
+                }
+                break;
+            default:
+                ESP_LOGE(TAG, "Peer rejected message (FC 0x%02X)", msg.data[0]);
+                return ESP_ERR_INVALID_SIZE;
+        }
+    }
+    ESP_LOGE(TAG, "No flow control from peer");
+    return ESP_ERR_TIMEOUT;
+}
+
+esp_err_t isotp_send(isotp_link_t *link, const uint8_t *data, size_t len) {
+    uint8_t frame[8];
+
+    if (len <= SF_MAX) {
+        frame[0] = PCI_SF | len;
+        memcpy(frame + 1, data, len);
+        return send_frame(link, frame, len + 1);
+    }
+
+    size_t pos;
+    if (len <= FF_MAX_12BIT) {
+        frame[0] = PCI_FF | (len >> 8);
+        frame[1] = len & 0xFF;
+        memcpy(frame + 2, data, 6);
+        pos = 6;
+    } else {
+        // Escape sequence: 12-bit length 0, then 32-bit length big endian
+        frame[0] = PCI_FF;
+        frame[1] = 0;
+        frame[2] = len >> 24;
+        frame[3] = (len >> 16) & 0xFF;
+        frame[4] = (len >> 8) & 0xFF;
+        frame[5] = len & 0xFF;
+        memcpy(frame + 6, data, 2);
+        pos = 2;
+    }
+    esp_err_t err = send_frame(link, frame, 8);
+    if (err != ESP_OK) return err;
+
+    uint8_t sn = 1;
+    while (pos < len) {
+        uint8_t block_size;
+        uint32_t st_min_us;
+        err = wait_flow_control(link, &block_size, &st_min_us);
+        if (err != ESP_OK) return err;
+
+        // The first CF may follow the FC immediately
+        int64_t next_us = esp_timer_get_time();
+        uint32_t spacing_us = st_min_us ? st_min_us + FRAME_AIRTIME_US : 0;
+        for (uint16_t n = 0; pos < len && (block_size == 0 || n < block_size); n++) {
+            if (spacing_us) wait_until(next_us);
+
+            size_t chunk = len - pos;
+            if (chunk > CF_PAYLOAD) chunk = CF_PAYLOAD;
+            frame[0] = PCI_CF | sn;
+            memcpy(frame + 1, data + pos, chunk);
+            next_us = esp_timer_get_time() + spacing_us;
+            err = send_frame(link, frame, chunk + 1);
+            if (err != ESP_OK) return err;
+
+            sn = (sn + 1) & 0x0F;
+            pos += chunk;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t isotp_receive(isotp_link_t *link, uint8_t *buf, size_t size, size_t *out_len, TickType_t timeout) {
+    twai_message_t msg;
+    TickType_t start = xTaskGetTickCount();
+    uint8_t type;
+    do {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout || recv_frame(link, &msg, timeout - elapsed) != ESP_OK) return ESP_ERR_TIMEOUT;
+        type = msg.data[0] & 0xF0;
+    } while (type != PCI_SF && type != PCI_FF);
+
+    if (type == PCI_SF) {
+        size_t len = msg.data[0] & 0x0F;
+        if (len == 0 || len > SF_MAX) return ESP_ERR_INVALID_RESPONSE;
+        if (len > size) return ESP_ERR_INVALID_SIZE;
+        memcpy(buf, msg.data + 1, len);
+        *out_len = len;
+        return ESP_OK;
+    }
+
+    size_t len = ((msg.data[0] & 0x0F) << 8) | msg.data[1];
+    size_t pos = 6;
+    const uint8_t *first = msg.data + 2;
+    if (len == 0) {
+        len = ((uint32_t)msg.data[2] << 24) | (msg.data[3] << 16) | (msg.data[4] << 8) | msg.data[5];
+        pos = 2;
+        first = msg.data + 6;
+        // The escape form is only valid for lengths the 12-bit field cannot hold
+        if (len <= FF_MAX_12BIT) return ESP_ERR_INVALID_RESPONSE;
+    } else if (len <= SF_MAX) {
+        // Would fit a single frame; also keeps the first-frame copy inside `len`
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (len > size) {
+        send_flow_control(link, FC_OVFLW);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(buf, first, pos);
+
+    esp_err_t err = send_flow_control(link, FC_CTS);
+    uint8_t sn = 1;
+    uint8_t in_block = 0;
+    while (err == ESP_OK && pos < len) {
+        if (recv_frame(link, &msg, pdMS_TO_TICKS(ISOTP_N_CR_TIMEOUT)) != ESP_OK) return ESP_ERR_TIMEOUT;
+        if ((msg.data[0] & 0xF0) != PCI_CF) continue;
+        if ((msg.data[0] & 0x0F) != sn) {
+            ESP_LOGE(TAG, "CF sequence %d, expected %d", msg.data[0] & 0x0F, sn);
+            return ESP_ERR_INVALID_RESPONSE;
+        }
+
+        size_t chunk = len - pos;
+        if (chunk > CF_PAYLOAD) chunk = CF_PAYLOAD;
+        memcpy(buf + pos, msg.data + 1, chunk);
+        pos += chunk;
+        sn = (sn + 1) & 0x0F;
+
+        if (link->rx_block_size && ++in_block == link->rx_block_size && pos < len) {
+            in_block = 0;
+            err = send_flow_control(link, FC_CTS);
+        }
+    }
+    *out_len = len;
+    return err;
+}
@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "app_shared.h"
+#include "can_manager.h"
+#include "job_queue.h"
+#include "ota_status.h"
+#include "task_config.h"
+
+static const char *TAG = "JOBS";
+
+#define BUS_POLL_DELAY 100 // ms between checks while a manual flash owns the bus
+
+typedef struct {
+    job_info_t info;
+    uint8_t *image;                 // RAM image (NULL for cached jobs)
+    uint8_t hash[IMAGE_HASH_LEN];   // Cache key when info.cached
+    bool store;                     // Write `image` to the cache before flashing
+    char label[IMAGE_LABEL_LEN];
+} job_slot_t;
+
+static job_slot_t jobs[JOB_QUEUE_LEN];
+static uint32_t next_job_id = 1;
+static SemaphoreHandle_t jobs_lock = NULL;
+static TaskHandle_t scheduler_handle = NULL;
+
+const char *job_state_name(job_state_t state) {
+    switch (state) {
+        case JOB_QUEUED:   return "queued";
+        case JOB_FLASHING: return "flashing";
+        case JOB_DONE:     return "done";
+        case JOB_FAILED:   return "failed";
+        default:           return "empty";
+    }
+}
+
+// --- SLOT HELPERS (call with jobs_lock held) ---
+
+static job_slot_t *find_job(uint32_t id) {
+    for (int i = 0; i < JOB_QUEUE_LEN; i++) {
+        if (jobs[i].info.state != JOB_EMPTY && jobs[i].info.id == id) return &jobs[i];
+    }
+    return NULL;
+}
+
+// Empty slot first, otherwise recycle the oldest finished job
+static job_slot_t *free_slot(void) {
+    job_slot_t *oldest = NULL;
+    for (int i = 0; i < JOB_QUEUE_LEN; i++) {
+        job_state_t st = jobs[i].info.state;
+        if (st == JOB_EMPTY) return &jobs[i];
+        if ((st == JOB_DONE || st == JOB_FAILED) && (!oldest || jobs[i].info.id < oldest->info.id)) {
+            oldest = &jobs[i];
+        }
+    }
+    return oldest;
+}
+
+static job_slot_t *next_queued(void) {
+    job_slot_t *next = NULL;
+    for (int i = 0; i < JOB_QUEUE_LEN; i++) {
+        if (jobs[i].info.state == JOB_QUEUED && (!next || jobs[i].info.id < next->info.id)) {
+            next = &jobs[i];
+        }
+    }
+    return next;
+}
+
+static void clear_slot(job_slot_t *slot) {
+    if (slot->image) free(slot->image);
+    memset(slot, 0, sizeof(*slot));
+}
+
+// --- PUBLIC API ---
+
+static esp_err_t add_job(uint8_t *image, const uint8_t *hash, size_t len, const char *target,
+                         can_transport_kind_t transport, ota_protocol_t protocol, bool page_align, const char *cache_label,
+                         uint32_t *out_id) {
+    xSemaphoreTake(jobs_lock, portMAX_DELAY);
+    job_slot_t *slot = free_slot();
+    if (!slot) {
+        xSemaphoreGive(jobs_lock);
+        if (image) free(image);
+        return ESP_ERR_NO_MEM;
+    }
+    clear_slot(slot);
+    slot->image = image;
+    if (hash) {
+        memcpy(slot->hash, hash, IMAGE_HASH_LEN);
+        slot->info.cached = true;
+    }
+    if (cache_label) {
+        slot->store = true;
+        strlcpy(slot->label, cache_label, IMAGE_LABEL_LEN);
+    }
+    slot->info.id = next_job_id++;
+    slot->info.size = len;
+    slot->info.transport = transport;
+    slot->info.protocol = protocol;
+    slot->info.page_align = page_align;
+    slot->info.state = JOB_QUEUED;
+    strlcpy(slot->info.target, target ? target : "", JOB_TARGET_LEN);
+    strcpy(slot->info.result, "Queued");
+    if (out_id) *out_id = slot->info.id;
+    ESP_LOGI(TAG, "Job %ld queued: %d bytes for '%s', %s over %s%s", slot->info.id, len, slot->info.target,
+             ota_protocol_name(protocol), can_transport_name(transport), hash ? " (cached)" : "");
+    xSemaphoreGive(jobs_lock);
+
+    xTaskNotifyGive(scheduler_handle);
+    return ESP_OK;
+}
+
+esp_err_t job_queue_add(uint8_t *image, size_t len, const char *target, can_transport_kind_t transport,
+                        ota_protocol_t protocol, bool page_align, const char *cache_label, uint32_t *out_id) {
+    return add_job(image, NULL, len, target, transport, protocol, page_align, cache_label, out_id);
+}
+
+esp_err_t job_queue_add_cached(const uint8_t hash[IMAGE_HASH_LEN], size_t len, const char *target,
+                               can_transport_kind_t transport, ota_protocol_t protocol, bool page_align, uint32_t *out_id) {
+    return add_job(NULL, hash, len, target, transport, protocol, page_align, NULL, out_id);
+}
+
+esp_err_t job_queue_remove(uint32_t id) {
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(jobs_lock, portMAX_DELAY);
+    job_slot_t *slot = find_job(id);
+    if (!slot) err = ESP_ERR_NOT_FOUND;
+    else if (slot->info.state == JOB_FLASHING) err = ESP_ERR_INVALID_STATE;
+    else clear_slot(slot);
+    xSemaphoreGive(jobs_lock);
+    return err;
+}
+
+size_t job_queue_list(job_info_t *out, size_t max) {
+    size_t n = 0;
+    uint32_t last_id = 0;
+    xSemaphoreTake(jobs_lock, portMAX_DELAY);
+    // Selection by id keeps the listing in submission order
+    while (n < max) {
+        job_slot_t *next = NULL;
+        for (int i = 0; i < JOB_QUEUE_LEN; i++) {
+            if (jobs[i].info.state == JOB_EMPTY || jobs[i].info.id <= last_id) continue;
+            if (!next || jobs[i].info.id < next->info.id) next = &jobs[i];
+        }
+        if (!next) break;
+        out[n++] = next->info;
+        last_id = next->info.id;
+    }
+    xSemaphoreGive(jobs_lock);
+    return n;
+}
+
+// --- SCHEDULER TASK ---
+
+static void job_scheduler_task(void *arg) {
+    while (1) {
+        xSemaphoreTake(jobs_lock, portMAX_DELAY);
+        job_slot_t *job = next_queued();
+        if (job) job->info.state = JOB_FLASHING;
+        xSemaphoreGive(jobs_lock);
+
+        if (!job) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        // The slot can't be recycled or removed while FLASHING, so it stays valid unlocked
+        const uint8_t *image = job->image;
+        size_t len = job->info.size;
+        if (job->info.cached && image_cache_acquire(job->hash, &image, &len) != ESP_OK) {
+            xSemaphoreTake(jobs_lock, portMAX_DELAY);
+            job->info.state = JOB_FAILED;
+            strcpy(job->info.result, "Not Cached");
+            ESP_LOGE(TAG, "Job %ld: image evicted from cache", job->info.id);
+            xSemaphoreGive(jobs_lock);
+            continue;
+        }
+
+        // A manual /api/flash may still own the bus
+        while (!ota_claim_bus()) vTaskDelay(pdMS_TO_TICKS(BUS_POLL_DELAY));
+
+        // Between transfers: the erase stalls the flash cache, which a running burst can't afford.
+        // This run still sends the RAM copy; later jobs for the hash use the cache.
+        if (job->store && image_cache_store(image, len, job->label, NULL) != ESP_OK) {
+            ESP_LOGW(TAG, "Job %ld: image not cached", job->info.id);
+        }
+        job->store = false;
+
+        ESP_LOGI(TAG, "Job %ld started", job->info.id);
+        esp_err_t res = run_update(image, len, job->info.transport, job->info.protocol, job->info.page_align);
+        if (job->info.cached) image_cache_release(job->hash);
+
+        xSemaphoreTake(jobs_lock, portMAX_DELAY);
+        job->info.state = (res == ESP_OK) ? JOB_DONE : JOB_FAILED;
+        ota_status_t status;
+        ota_status_read(&status);
+        strlcpy(job->info.result, ota_status_text(&status), sizeof(job->info.result));
+        // Finished images are dropped right away to make room for the next upload
+        if (job->image) free(job->image);
+        job->image = NULL;
+        ESP_LOGI(TAG, "Job %ld finished: %s", job->info.id, job->info.result);
+        xSemaphoreGive(jobs_lock);
+
+        ota_release_bus();
+    }
+}
+
+esp_err_t start_job_scheduler(void) {
+    jobs_lock = xSemaphoreCreateMutex();
+    if (!jobs_lock) return ESP_ERR_NO_MEM;
+
+    BaseType_t res = xTaskCreatePinnedToCore(job_scheduler_task, "job_scheduler", CAN_TASK_STACK, NULL, CAN_TASK_PRIORITY, &scheduler_handle, CAN_TASK_CORE);
+    return (res == pdPASS) ? ESP_OK : ESP_FAIL;
+}
@@ -0,0 +1,97 @@
+#include <string.h>
+#include "lzss.h"
+
+// --- ENCODER (gateway) ---
+
+// Longest match for in[pos] within the window, greedy
+static size_t find_match(const uint8_t *in, size_t len, size_t pos, size_t *distance) {
+    size_t best = 0;
+    size_t max_len = len - pos;
+    if (max_len > LZSS_MAX_MATCH) max_len = LZSS_MAX_MATCH;
+    if (max_len < LZSS_MIN_MATCH) return 0;
+
+    size_t max_dist = pos < LZSS_WINDOW ? pos : LZSS_WINDOW;
+    for (size_t d = 1; d <= max_dist; d++) {
+        const uint8_t *cand = in + pos - d;
+        if (cand[0] != in[pos] || cand[best] != in[pos + best]) continue;
+        size_t n = 0;
+        while (n < max_len && cand[n] == in[pos + n]) n++;
+        if (n > best) {
+            best = n;
+            *distance = d;
+            if (best == max_len) break;
+        }
+    }
+    return best >= LZSS_MIN_MATCH ? best : 0;
+}
+
+size_t lzss_encode(const uint8_t *in, size_t len, uint8_t *out, size_t out_cap) {
+    size_t pos = 0;
+    size_t o = 0;
+    size_t flag_at = 0;
+    int item = 8;
+
+    while (pos < len) {
+        if (item == 8) {
+            if (o >= out_cap) return 0;
+            flag_at = o;
+            out[o++] = 0;
+            item = 0;
+        }
+
+        size_t distance = 0;
+        size_t n = find_match(in, len, pos, &distance);
+        if (n) {
+            if (o + 2 > out_cap) return 0;
+            out[flag_at] |= 1 << item;
+            out[o++] = distance - 1;
+            out[o++] = n - LZSS_MIN_MATCH;
+            pos += n;
+        } else {
+            if (o + 1 > out_cap) return 0;
+            out[o++] = in[pos++];
+        }
+        item++;
+    }
+    return o;
+}
+
+// --- REFERENCE DECODER (BMS) ---
+
+static void emit(lzss_decoder_t *d, uint8_t byte, lzss_sink_t sink, void *ctx) {
+    d->window[d->pos++] = byte; // uint8_t wraps at LZSS_WINDOW
+    sink(ctx, byte);
+}
+
+void lzss_decoder_init(lzss_decoder_t *d) {
+    memset(d, 0, sizeof(*d));
+}
+
+size_t lzss_decode(lzss_decoder_t *d, const uint8_t *in, size_t len, lzss_sink_t sink, void *ctx) {
+    size_t produced = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t b = in[i];
+
+        if (d->in_match) {
+            // Second byte of a match: copy one byte at a time so overlaps work
+            uint8_t from = d->pos - d->distance - 1;
+            for (size_t n = 0; n < (size_t)b + LZSS_MIN_MATCH; n++) emit(d, d->window[from++], sink, ctx);
+            produced += (size_t)b + LZSS_MIN_MATCH;
+            d->in_match = false;
+        } else if (d->items_left == 0) {
+            d->flags = b;
+            d->items_left = 8;
+            continue;
+        } else if (d->flags & 1) {
+            d->distance = b;
+            d->in_match = true;
+            continue;
+        } else {
+            emit(d, b, sink, ctx);
+            produced++;
+        }
+        d->flags >>= 1;
+        d->items_left--;
+    }
+    return produced;
+}
@@ -3,6 +3,11 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "web_server.h"
+#include "job_queue.h"
+#include "image_cache.h"
+#include "upload_session.h"
+#include "transfer_plan.h"
+#include "session_arena.h"
 #include "sdkconfig.h" // Required to read the menuconfig variables
 
 static const char *TAG = "MAIN";
@@ -54,9 +59,24 @@ void app_main(void) {
     }
     ESP_ERROR_CHECK(ret);
 
+    // Upload and transfer buffers, reserved before WiFi and httpd fragment the heap
+    ESP_ERROR_CHECK(session_arena_init());
+
     // Start WiFi AP
     wifi_init_softap();
 
+    // Flash image cache is optional, jobs fall back to RAM images without it
+    image_cache_init();
+
+    // Timing model for /api/plan, calibrated by past sessions
+    transfer_plan_init();
+
+    // Start Job Scheduler (flashes queued images back to back)
+    ESP_ERROR_CHECK(start_job_scheduler());
+
+    // Chunked uploads (resumable); the single-POST upload does not need it
+    ESP_ERROR_CHECK(upload_session_init());
+
     // Start Web Server
     start_webserver();
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include <string.h>
+#include "ota_status.h"
+
+// Sequence lock over two buffers.
+// seq is odd while a publish is in progress; the readable buffer is (seq >> 1) & 1.
+// A publish always writes the other buffer, so the writer never waits for readers.
+// A reader's copy is only stale-and-torn if the writer came back around to the
+// same buffer, i.e. seq moved past the next even value.
+static ota_status_t status_buf[2] = {
+    { .busy = false, .state = OTA_STATE_IDLE, .error = OTA_ERR_NONE },
+    { .busy = false, .state = OTA_STATE_IDLE, .error = OTA_ERR_NONE },
+};
+static uint32_t status_seq = 0;
+
+void ota_status_publish(const ota_status_t *status) {
+    uint32_t seq = __atomic_load_n(&status_seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&status_seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    status_buf[((seq >> 1) + 1) & 1] = *status;
+
+    __atomic_store_n(&status_seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void ota_status_read(ota_status_t *out) {
+    uint32_t start, end;
+    do {
+        start = __atomic_load_n(&status_seq, __ATOMIC_ACQUIRE);
+        *out = status_buf[(start >> 1) & 1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&status_seq, __ATOMIC_RELAXED);
+    } while (end - (start & ~1u) > 2);
+}
+
+const char *ota_state_name(ota_state_t state) {
+    switch (state) {
+        case OTA_STATE_IDLE:         return "Idle";
+        case OTA_STATE_INITIALIZING: return "Initializing";
+        case OTA_STATE_HANDSHAKE_OK: return "Handshake OK";
+        case OTA_STATE_FLASHING:     return "Flashing";
+        case OTA_STATE_VERIFYING:    return "Verifying";
+        case OTA_STATE_SUCCESS:      return "Success";
+        case OTA_STATE_FAILED:       return "Failed";
+        default:                     return "Unknown";
+    }
+}
+
+const char *ota_error_name(ota_error_t error) {
+    switch (error) {
+        case OTA_ERR_NONE:            return "";
+        case OTA_ERR_RETRY_LIMIT:     return "Retry Limit";
+        case OTA_ERR_VERIFY_MISMATCH: return "Verify Mismatch";
+        case OTA_ERR_VERIFY_TIMEOUT:  return "Verify Timeout";
+        case OTA_ERR_BUS_OFF:         return "Bus Off";
+        case OTA_ERR_BMS_TIMEOUT:     return "BMS Timeout";
+        case OTA_ERR_TRANSPORT:       return "Transport Error";
+        case OTA_ERR_UDS_REJECTED:    return "UDS Rejected";
+        case OTA_ERR_IMAGE_TOO_LARGE: return "Image Too Large";
+        default:                      return "Unknown Error";
+    }
+}
+
+const char *ota_phase_name(ota_phase_t phase) {
+    switch (phase) {
+        case OTA_PHASE_IDLE:        return "idle";
+        case OTA_PHASE_HANDSHAKE:   return "handshake";
+        case OTA_PHASE_SENDING:     return "sending";
+        case OTA_PHASE_WAIT_ACK:    return "wait_ack";
+        case OTA_PHASE_FLASH_PAUSE: return "flash_pause";
+        case OTA_PHASE_VERIFY:      return "verify";
+        default:                    return "unknown";
+    }
+}
+
+const char *ota_status_text(const ota_status_t *status) {
+    if (status->state == OTA_STATE_FAILED && status->error != OTA_ERR_NONE) return ota_error_name(status->error);
+    return ota_state_name(status->state);
+}
@@ -0,0 +1,117 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "session_arena.h"
+
+static const char *TAG = "ARENA";
+
+#define ARENA_ALIGN(len) (((len) + 3) & ~(size_t)3)
+
+static portMUX_TYPE arena_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t *arena = NULL;
+static size_t arena_size = 0;
+static size_t slot_used[2] = {0}; // Slot 0 grows up from the bottom, slot 1 down from the top
+static int active = 0;
+static size_t scratch_used = 0;   // Next to the active slot, growing towards the other one
+static uint32_t scratch_peak = 0;
+static uint32_t failures = 0;
+static uint32_t largest_block_min = UINT32_MAX;
+
+static void sample_heap(void) {
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    if (largest < largest_block_min) largest_block_min = largest;
+}
+
+esp_err_t session_arena_init(void) {
+    arena_size = CONFIG_BMS_SESSION_ARENA_KB * 1024;
+    arena = heap_caps_malloc(arena_size, MALLOC_CAP_8BIT);
+    if (!arena) {
+        ESP_LOGE(TAG, "Could not reserve %d bytes", arena_size);
+        arena_size = 0;
+        return ESP_ERR_NO_MEM;
+    }
+    slot_used[0] = slot_used[1] = 0;
+    active = 0;
+    scratch_used = 0;
+    sample_heap();
+    ESP_LOGI(TAG, "Reserved %d bytes, largest free block now %ld", arena_size, largest_block_min);
+    return ESP_OK;
+}
+
+static size_t free_bytes(void) {
+    return arena_size - slot_used[0] - slot_used[1] - scratch_used;
+}
+
+void *session_arena_stage_alloc(size_t len) {
+    void *p = NULL;
+    int next = !active;
+    len = ARENA_ALIGN(len);
+    portENTER_CRITICAL(&arena_lock);
+    if (len <= free_bytes()) {
+        p = next == 0 ? arena + slot_used[0] : arena + arena_size - slot_used[1] - len;
+        slot_used[next] += len;
+    } else {
+        failures++;
+    }
+    portEXIT_CRITICAL(&arena_lock);
+    if (!p) ESP_LOGE(TAG, "Stage allocation of %d bytes does not fit", len);
+    return p;
+}
+
+void session_arena_stage_reset(void) {
+    portENTER_CRITICAL(&arena_lock);
+    slot_used[!active] = 0;
+    portEXIT_CRITICAL(&arena_lock);
+    sample_heap();
+}
+
+void session_arena_stage_swap(void) {
+    portENTER_CRITICAL(&arena_lock);
+    slot_used[active] = 0;
+    active = !active;
+    scratch_used = 0;
+    portEXIT_CRITICAL(&arena_lock);
+    sample_heap();
+}
+
+void *session_arena_scratch_alloc(size_t len) {
+    void *p = NULL;
+    len = ARENA_ALIGN(len);
+    portENTER_CRITICAL(&arena_lock);
+    if (len <= free_bytes()) {
+        p = active == 0 ? arena + slot_used[0] + scratch_used : arena + arena_size - slot_used[1] - scratch_used - len;
+        scratch_used += len;
+        if (scratch_used > scratch_peak) scratch_peak = scratch_used;
+    } else {
+        failures++;
+    }
+    portEXIT_CRITICAL(&arena_lock);
+    if (!p) ESP_LOGW(TAG, "Scratch allocation of %d bytes does not fit", len);
+    return p;
+}
+
+void session_arena_scratch_reset(void) {
+    portENTER_CRITICAL(&arena_lock);
+    scratch_used = 0;
+    portEXIT_CRITICAL(&arena_lock);
+    sample_heap();
+}
+
+void session_arena_stats(session_arena_stats_t *out) {
+    sample_heap();
+    portENTER_CRITICAL(&arena_lock);
+    out->size = arena_size;
+    out->stage_used = slot_used[active];
+    out->next_used = slot_used[!active];
+    out->scratch_used = scratch_used;
+    out->scratch_peak = scratch_peak;
+    out->failures = failures;
+    portEXIT_CRITICAL(&arena_lock);
+    out->heap_free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    out->heap_min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    out->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    out->largest_block_min = largest_block_min;
+}
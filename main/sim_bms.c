@@ -0,0 +1,512 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_crc.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "can_protocol.h"
+#include "can_codec.h"
+#include "lzss.h"
+#include "flash_geometry.h"
+#include "sim_bms.h"
+
+static const char *TAG = "SIM_BMS";
+
+#define REPLY_QUEUE_LEN 8
+
+typedef enum {
+    SIM_IDLE,
+    SIM_HANDSHAKE,  // Answered the handshake, waiting for the reset
+    SIM_STARTED,    // Answered the reset, waiting for the size
+    SIM_RECEIVING,
+    SIM_DONE
+} sim_state_t;
+
+static QueueHandle_t replies = NULL;
+static sim_state_t sim_state = SIM_IDLE;
+static size_t expected_len = 0;
+static size_t received = 0;
+static uint8_t burst_count = 0;
+static uint32_t image_crc32 = 0; // Of the decoded image, as written to "flash"
+
+// --- DATA ENCODING ---
+static uint8_t data_encoding = DATA_ENCODING_RAW;
+static lzss_decoder_t lzss;
+static uint32_t decoded_len = 0;
+static uint32_t flash_len = 0; // Decoded length, what ends up in flash
+
+// --- DATA FRAMING ---
+// Offered in BMS_CAPS before the handshake answer, 0 behaves like a legacy bootloader
+static uint8_t caps = SIM_BMS_CAPS;
+static uint8_t caps_burst = SIM_BMS_BURST;
+static uint8_t framing = DATA_FRAMING_LEGACY;
+static uint8_t burst_frames = BURST_FRAMES;
+static uint8_t burst_buf[MAX_BURST_FRAMES * FRAME_PAYLOAD_FULL]; // Held until the burst CRC checks out
+
+// --- FLASH ---
+// One page buffer: a full page is programmed for write_ms. Replies that would
+// follow are held back until the write ends and FLASH_DONE is sent, and data
+// frames that arrive meanwhile stall (and are answered with FLASH_BUSY).
+// The menuconfig descriptor, as the gateway uses; a page size of 0 writes instantly.
+static flash_geometry_t geometry;
+static uint32_t page_fill = 0;
+static bool writing = false;
+static int64_t write_end_us = 0;
+static twai_message_t held[REPLY_QUEUE_LEN];
+static size_t held_count = 0;
+static bool stall_answered = false; // One FLASH_BUSY per stalled burst or page write
+static sim_bms_flash_stats_t flash_stats;
+
+// --- ISO-TP RECEIVER ---
+static uint8_t isotp_block_size = 8;
+static uint8_t isotp_st_min = 0;
+static size_t isotp_expected = 0; // Length of the message being reassembled, 0 if idle
+static size_t isotp_received = 0;
+static uint8_t isotp_sn = 0;
+static uint8_t isotp_in_block = 0;
+static uint32_t isotp_total = 0;
+static uint8_t isotp_head[12]; // Start of the message: UDS service and parameters
+
+// --- UDS SERVER ---
+#define UDS_MAX_BLOCK_LEN 0x1002 // Advertised maxNumberOfBlockLength: 4 KB of data per TransferData
+static uint8_t uds_counter = 0;
+static uint32_t uds_crc32 = 0;
+
+static void send_reply(const twai_message_t *msg) {
+    if (xQueueSend(replies, msg, 0) != pdTRUE) ESP_LOGW(TAG, "Reply queue full");
+}
+
+static void queue_reply(const twai_message_t *msg) {
+    if (!writing) {
+        send_reply(msg);
+    } else if (held_count < REPLY_QUEUE_LEN) {
+        held[held_count++] = *msg;
+    } else {
+        ESP_LOGW(TAG, "Held reply queue full");
+    }
+}
+
+// Queues a response, encoded from the protocol table like a real BMS would send it
+static void reply(bms_response_t kind) {
+    twai_message_t msg;
+    can_encode_response(kind, &msg);
+    queue_reply(&msg);
+}
+
+static void isotp_flow_control(uint8_t status) {
+    twai_message_t msg = { .extd = CONFIG_BMS_ISOTP_RESPONSE_ID > 0x7FF, .identifier = CONFIG_BMS_ISOTP_RESPONSE_ID,
+                           .data_length_code = 8, .data = { 0x30 | status, isotp_block_size, isotp_st_min } };
+    queue_reply(&msg);
+}
+
+// UDS responses all fit a single frame
+static void uds_reply(const uint8_t *data, size_t len) {
+    twai_message_t msg = { .extd = CONFIG_BMS_ISOTP_RESPONSE_ID > 0x7FF, .identifier = CONFIG_BMS_ISOTP_RESPONSE_ID,
+                           .data_length_code = 8 };
+    memset(msg.data, 0xCC, 8);
+    msg.data[0] = len;
+    memcpy(msg.data + 1, data, len);
+    queue_reply(&msg);
+}
+
+static void uds_negative(uint8_t sid, uint8_t nrc) {
+    uint8_t resp[3] = { 0x7F, sid, nrc };
+    uds_reply(resp, sizeof(resp));
+}
+
+static void uds_request(const uint8_t *req, size_t len) {
+    switch (req[0]) {
+        case 0x10: { // Session control: P2 50 ms, P2* 5 s
+            uint8_t resp[] = { 0x50, req[1], 0x00, 0x32, 0x01, 0xF4 };
+            uds_reply(resp, sizeof(resp));
+            break;
+        }
+        case 0x31: {
+            uint16_t routine = (req[2] << 8) | req[3];
+            uint8_t resp[5] = { 0x71, req[1], req[2], req[3], 0 };
+            if (routine == 0xFF00) {
+                // Erasing takes a while on a real ECU, exercise responsePending
+                uds_negative(0x31, 0x78);
+                uds_reply(resp, 4);
+            } else if (routine == 0x0202) {
+                uint32_t crc = ((uint32_t)req[4] << 24) | (req[5] << 16) | (req[6] << 8) | req[7];
+                resp[4] = (crc == uds_crc32) ? 0 : 1;
+                uds_reply(resp, 5);
+            } else {
+                uds_negative(0x31, 0x31);
+            }
+            break;
+        }
+        case 0x34: {
+            uds_counter = 1;
+            uds_crc32 = 0;
+            uint8_t resp[] = { 0x74, 0x20, UDS_MAX_BLOCK_LEN >> 8, UDS_MAX_BLOCK_LEN & 0xFF };
+            uds_reply(resp, sizeof(resp));
+            break;
+        }
+        case 0x36: {
+            if (req[1] != uds_counter) {
+                uds_negative(0x36, 0x73);
+                break;
+            }
+            uint8_t resp[] = { 0x76, uds_counter++ };
+            uds_reply(resp, sizeof(resp));
+            break;
+        }
+        case 0x37: {
+            uint8_t resp[] = { 0x77 };
+            uds_reply(resp, sizeof(resp));
+            break;
+        }
+        case 0x11: {
+            uint8_t resp[] = { 0x51, req[1] };
+            uds_reply(resp, sizeof(resp));
+            break;
+        }
+        default:
+            uds_negative(req[0], 0x11);
+            break;
+    }
+}
+
+// Takes the next `len` bytes of the message being reassembled. The whole
+// message is never buffered: the head is kept for the UDS server and
+// TransferData payload only goes into the running CRC-32.
+static void isotp_data(const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len && isotp_received + i < sizeof(isotp_head); i++) {
+        isotp_head[isotp_received + i] = data[i];
+    }
+    if (isotp_head[0] == 0x36) {
+        size_t skip = (isotp_received < 2) ? 2 - isotp_received : 0;
+        if (skip < len) uds_crc32 = esp_crc32_le(uds_crc32, data + skip, len - skip);
+    }
+    isotp_received += len;
+    if (isotp_received < isotp_expected) return;
+
+    size_t msg_len = isotp_expected;
+    isotp_total += msg_len;
+    isotp_expected = 0;
+    uds_request(isotp_head, msg_len);
+}
+
+static void on_isotp(const twai_message_t *msg) {
+    uint8_t pci = msg->data[0] & 0xF0;
+    if (pci == 0x00) {
+        isotp_expected = msg->data[0] & 0x0F;
+        isotp_received = 0;
+        if (!isotp_expected) return;
+        isotp_data(msg->data + 1, isotp_expected);
+    } else if (pci == 0x10) {
+        size_t len = ((msg->data[0] & 0x0F) << 8) | msg->data[1];
+        size_t first = 6;
+        if (len == 0) {
+            len = ((uint32_t)msg->data[2] << 24) | (msg->data[3] << 16) | (msg->data[4] << 8) | msg->data[5];
+            first = 2;
+        }
+        isotp_expected = len;
+        isotp_received = 0;
+        isotp_sn = 1;
+        isotp_in_block = 0;
+        isotp_flow_control(0);
+        isotp_data(msg->data + 8 - first, first);
+    } else if (pci == 0x20 && isotp_expected) {
+        if ((msg->data[0] & 0x0F) != isotp_sn) {
+            ESP_LOGW(TAG, "ISO-TP sequence %d, expected %d", msg->data[0] & 0x0F, isotp_sn);
+            isotp_expected = 0;
+            return;
+        }
+        isotp_sn = (isotp_sn + 1) & 0x0F;
+        size_t len = isotp_expected - isotp_received;
+        isotp_data(msg->data + 1, len > 7 ? 7 : len);
+        if (isotp_expected && isotp_block_size && ++isotp_in_block == isotp_block_size) {
+            isotp_in_block = 0;
+            isotp_flow_control(0);
+        }
+    }
+}
+
+// Decoder sink: stands in for the page buffer of a real bootloader
+static void write_byte(void *ctx, uint8_t byte) {
+    image_crc32 = esp_crc32_le(image_crc32, &byte, 1);
+}
+
+static void program_page(void) {
+    twai_message_t msg;
+    int64_t now = esp_timer_get_time();
+    flash_stats.pages++;
+    if (!writing) {
+        can_encode_response(BMS_FLASH_BUSY, &msg);
+        send_reply(&msg);
+        flash_stats.busy_replies++;
+        writing = true;
+        write_end_us = now;
+    }
+    if (write_end_us < now) write_end_us = now;
+    write_end_us += (int64_t)geometry.write_ms * 1000;
+}
+
+// Counts `len` decoded bytes into the page buffer, programming every page that fills
+static void flash_write(size_t len) {
+    if (!geometry.page_bytes) return;
+    page_fill += len;
+    while (page_fill >= geometry.page_bytes) {
+        page_fill -= geometry.page_bytes;
+        program_page();
+    }
+    if (decoded_len >= flash_len && page_fill) {
+        page_fill = 0;
+        program_page();
+    }
+}
+
+// A data frame while a page is being programmed waits in the controller. So
+// does one that arrives after a full-framing burst filled the page: the page
+// cannot be programmed before the burst CRC has checked it.
+static void check_stall(void) {
+    bool page_held = framing == DATA_FRAMING_FULL && geometry.page_bytes &&
+                     page_fill + burst_count * FRAME_PAYLOAD_FULL >= geometry.page_bytes;
+    if (!page_held && (!writing || esp_timer_get_time() >= write_end_us)) return;
+    flash_stats.stalls++;
+    if (stall_answered) return;
+    twai_message_t msg;
+    can_encode_response(BMS_FLASH_BUSY, &msg);
+    send_reply(&msg);
+    flash_stats.busy_replies++;
+    stall_answered = true;
+}
+
+// Writes `len` received bytes, through the decoder for an LZSS stream
+static void write_payload(const uint8_t *payload, size_t len) {
+    size_t decoded = len;
+    if (data_encoding == DATA_ENCODING_LZSS) {
+        decoded = lzss_decode(&lzss, payload, len, write_byte, NULL);
+    } else {
+        image_crc32 = esp_crc32_le(image_crc32, payload, len);
+    }
+    decoded_len += decoded;
+    received += len;
+    flash_write(decoded);
+}
+
+static void burst_done(void) {
+    burst_count = 0;
+    stall_answered = false;
+    reply(BMS_COMPLETE);
+    if (received < expected_len) reply(BMS_REQUEST);
+    else sim_state = SIM_DONE;
+}
+
+// Full framing: frames carry no CRC and are only buffered until the burst CRC
+static void on_data_full(const twai_message_t *msg) {
+    check_stall();
+    if (burst_count < burst_frames) memcpy(&burst_buf[burst_count * FRAME_PAYLOAD_FULL], msg->data, FRAME_PAYLOAD_FULL);
+    burst_count++;
+}
+
+static void on_burst_crc(const twai_message_t *msg) {
+    uint8_t frames = burst_count;
+    size_t len = frames * FRAME_PAYLOAD_FULL;
+    burst_count = 0;
+    stall_answered = false;
+    if (framing != DATA_FRAMING_FULL || frames == 0 || frames > burst_frames || msg->data[2] != frames ||
+        (msg->data[0] | (msg->data[1] << 8)) != calcrc(burst_buf, len)) {
+        twai_message_t nack;
+        can_encode_response(BMS_NACK, &nack);
+        nack.data[1] = BURST_NACK_ALL;
+        queue_reply(&nack);
+        return;
+    }
+
+    if (len > expected_len - received) len = expected_len - received;
+    write_payload(burst_buf, len);
+    burst_done();
+}
+
+static void on_data(const twai_message_t *msg) {
+    if (framing == DATA_FRAMING_FULL) {
+        on_data_full(msg);
+        return;
+    }
+    check_stall();
+
+    uint8_t payload[FRAME_PAYLOAD];
+    memcpy(payload, msg->data, FRAME_PAYLOAD);
+    uint16_t crc = calcrc(payload, FRAME_PAYLOAD);
+    if ((msg->data[6] | (msg->data[7] << 8)) != crc) {
+        twai_message_t nack;
+        can_encode_response(BMS_NACK, &nack);
+        nack.data[1] = burst_count;
+        queue_reply(&nack);
+        return;
+    }
+
+    size_t len = expected_len - received;
+    if (len > FRAME_PAYLOAD) len = FRAME_PAYLOAD;
+    write_payload(payload, len);
+
+    if (++burst_count < BURST_FRAMES && received < expected_len) return;
+    burst_done();
+}
+
+// A fill frame is a burst of its own: write the range, then answer like after the last data frame
+static void on_fill(const twai_message_t *msg) {
+    uint32_t offset, len;
+    uint8_t value;
+    if (data_encoding != DATA_ENCODING_SPARSE || !can_decode_fill(msg, &offset, &len, &value) ||
+        offset != received || len > expected_len - received) {
+        twai_message_t nack;
+        can_encode_response(BMS_NACK, &nack);
+        nack.data[1] = 0;
+        queue_reply(&nack);
+        return;
+    }
+
+    for (uint32_t i = 0; i < len; i++) write_byte(NULL, value);
+    decoded_len += len;
+    received += len;
+    flash_write(len);
+    burst_done();
+}
+
+esp_err_t sim_bms_start(size_t image_len) {
+    if (!replies) replies = xQueueCreate(REPLY_QUEUE_LEN, sizeof(twai_message_t));
+    if (!replies) return ESP_ERR_NO_MEM;
+    xQueueReset(replies);
+
+    sim_state = SIM_IDLE;
+    expected_len = image_len;
+    received = 0;
+    burst_count = 0;
+    image_crc32 = 0;
+    data_encoding = DATA_ENCODING_RAW;
+    decoded_len = 0;
+    flash_len = image_len;
+    flash_geometry_config(&geometry);
+    page_fill = geometry.page_bytes ? geometry.align % geometry.page_bytes : 0;
+    writing = false;
+    stall_answered = false;
+    held_count = 0;
+    memset(&flash_stats, 0, sizeof(flash_stats));
+    framing = DATA_FRAMING_LEGACY;
+    burst_frames = BURST_FRAMES;
+    isotp_expected = 0;
+    isotp_total = 0;
+    uds_counter = 0;
+    uds_crc32 = 0;
+    ESP_LOGI(TAG, "Simulated BMS ready for %d bytes", image_len);
+    return ESP_OK;
+}
+
+void sim_bms_stop(void) {
+    if (replies) xQueueReset(replies);
+    sim_state = SIM_IDLE;
+}
+
+void sim_bms_on_frame(const twai_message_t *msg) {
+    if (msg->identifier == CONFIG_BMS_ISOTP_REQUEST_ID) {
+        on_isotp(msg);
+        return;
+    }
+
+    switch (msg->identifier) {
+        case ID_HANDSHAKE:
+            if (can_decode_command(msg) == CMD_START_HANDSHAKE && sim_state == SIM_IDLE) {
+                sim_state = SIM_HANDSHAKE;
+                if (caps) {
+                    twai_message_t msg_out;
+                    can_encode_response(BMS_CAPS, &msg_out);
+                    msg_out.data[1] = caps;
+                    msg_out.data[2] = caps_burst;
+                    queue_reply(&msg_out);
+                }
+                reply(BMS_HANDSHAKE);
+            } else if (can_decode_command(msg) == CMD_RESET_BMS && sim_state == SIM_HANDSHAKE) {
+                sim_state = SIM_STARTED;
+                reply(BMS_START);
+            }
+            break;
+        case ID_SIZE:
+            // The size before the handshake is ignored, like on the real bootloader
+            if (sim_state != SIM_STARTED) break;
+            sim_state = SIM_RECEIVING;
+            data_encoding = msg->data[2];
+            if (data_encoding == DATA_ENCODING_LZSS) {
+                lzss_decoder_init(&lzss);
+                flash_len = msg->data[3] | (msg->data[4] << 8) | ((uint32_t)msg->data[5] << 16);
+            }
+            // Only what was offered is accepted, anything else falls back to legacy framing
+            framing = DATA_FRAMING_LEGACY;
+            burst_frames = BURST_FRAMES;
+            if (msg->data[6] == DATA_FRAMING_FULL && (caps & BMS_CAP_FULL_FRAMES) &&
+                msg->data[7] >= 1 && msg->data[7] <= MAX_BURST_FRAMES) {
+                framing = DATA_FRAMING_FULL;
+                burst_frames = msg->data[7];
+            }
+            reply(BMS_UPDATE_ONGOING);
+            reply(BMS_REQUEST);
+            break;
+        case ID_DATA:
+            if (sim_state == SIM_RECEIVING) on_data(msg);
+            break;
+        case ID_FILL:
+            if (sim_state == SIM_RECEIVING) on_fill(msg);
+            break;
+        case ID_BURST_CRC:
+            if (sim_state == SIM_RECEIVING) on_burst_crc(msg);
+            break;
+        case ID_VERIFY: {
+            twai_message_t msg_out;
+            ESP_LOGI(TAG, "Verify: %ld bytes written, CRC 0x%08lX", decoded_len, image_crc32);
+            can_encode_response(BMS_VERIFY, &msg_out);
+            msg_out.data[1] = image_crc32 & 0xFF;
+            msg_out.data[2] = (image_crc32 >> 8) & 0xFF;
+            msg_out.data[3] = (image_crc32 >> 16) & 0xFF;
+            msg_out.data[4] = image_crc32 >> 24;
+            queue_reply(&msg_out);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+esp_err_t sim_bms_receive(twai_message_t *msg, TickType_t timeout) {
+    if (!replies) return ESP_ERR_INVALID_STATE;
+    if (xQueueReceive(replies, msg, 0) == pdTRUE) return ESP_OK;
+    if (!writing) return xQueueReceive(replies, msg, timeout) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+
+    // Nothing else to say until the page write ends
+    int64_t wait_us = write_end_us - esp_timer_get_time();
+    if (wait_us > 0) {
+        TickType_t ticks = pdMS_TO_TICKS((wait_us + 999) / 1000);
+        vTaskDelay(ticks < timeout ? ticks : timeout);
+        if (esp_timer_get_time() < write_end_us) return ESP_ERR_TIMEOUT;
+    }
+    writing = false;
+    stall_answered = false;
+    can_encode_response(BMS_FLASH_DONE, msg);
+    for (size_t i = 0; i < held_count; i++) send_reply(&held[i]);
+    held_count = 0;
+    return ESP_OK;
+}
+
+void sim_bms_set_isotp_flow(uint8_t block_size, uint8_t st_min) {
+    isotp_block_size = block_size;
+    isotp_st_min = st_min;
+}
+
+void sim_bms_flash_stats(sim_bms_flash_stats_t *out) {
+    *out = flash_stats;
+}
+
+void sim_bms_set_caps(uint8_t bms_caps, uint8_t burst) {
+    caps = bms_caps;
+    caps_burst = burst;
+}
+
+uint32_t sim_bms_isotp_bytes(void) {
+    return isotp_total;
+}
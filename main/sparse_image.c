@@ -0,0 +1,67 @@
+#include "sparse_image.h"
+#include "can_protocol.h"
+
+// Value all `len` bytes share, -1 if they differ
+static int uniform_value(const uint8_t *p, size_t len) {
+    for (size_t i = 1; i < len; i++) {
+        if (p[i] != p[0]) return -1;
+    }
+    return p[0];
+}
+
+size_t sparse_find_runs(const uint8_t *image, size_t len, size_t page, fill_run_t *runs, size_t max) {
+    size_t count = 0;
+    fill_run_t cur = { 0 };
+    if (page == 0) return 0;
+
+    for (size_t pos = 0; pos < len; pos += page) {
+        size_t n = len - pos < page ? len - pos : page;
+        int value = uniform_value(image + pos, n);
+        if (value >= 0 && cur.len && cur.value == value && cur.offset + cur.len == pos) {
+            cur.len += n;
+            continue;
+        }
+        if (cur.len) {
+            if (runs && count < max) runs[count] = cur;
+            count++;
+            cur.len = 0;
+        }
+        if (value >= 0) cur = (fill_run_t){ .offset = pos, .len = n, .value = value };
+    }
+    if (cur.len) {
+        if (runs && count < max) runs[count] = cur;
+        count++;
+    }
+    return count;
+}
+
+const fill_run_t *sparse_run_at(const fill_run_t *runs, size_t count, uint32_t offset) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (offset < runs[mid].offset) hi = mid;
+        else if (offset >= runs[mid].offset + runs[mid].len) lo = mid + 1;
+        else return &runs[mid];
+    }
+    return NULL;
+}
+
+uint32_t sparse_count_frames(size_t len, const fill_run_t *runs, size_t count, uint32_t burst_frames) {
+    uint32_t frames = 0;
+    size_t pos = 0;
+    if (burst_frames == 0) return 0;
+    while (pos < len) {
+        const fill_run_t *run = sparse_run_at(runs, count, pos);
+        if (run) {
+            frames++;
+            pos = run->offset + run->len;
+        } else {
+            for (uint32_t i = 0; i < burst_frames && pos < len; i++) {
+                frames++;
+                pos += FRAME_PAYLOAD;
+            }
+        }
+        frames += 2; // BMS request and complete
+    }
+    return frames;
+}
@@ -0,0 +1,149 @@
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "transfer_plan.h"
+#include "can_protocol.h"
+#include "flash_geometry.h"
+
+static const char *TAG = "PLAN";
+
+#define PLAN_NVS_NAMESPACE "plan"
+#define PLAN_EWMA_SHIFT 2 // Newest session weighs 1/4
+
+// Used until a transport has a finished session to learn from
+#define DEFAULT_BMS_REPLY_MS 100   // Per handshake reply
+#define DEFAULT_TURNAROUND_US 2000 // Gateway loop plus BMS request/complete processing
+
+// Bits outside the stuffed region: CRC delimiter, ACK slot and delimiter, EOF, intermission
+#define FRAME_TAIL_BITS (1 + 2 + 7 + 3)
+
+static plan_calibration_t calibration[CAN_TRANSPORT_COUNT];
+
+static void save_calibration(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(PLAN_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return;
+    if (nvs_set_blob(nvs, "cal", calibration, sizeof(calibration)) == ESP_OK) nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static uint32_t ewma_u32(uint32_t avg, uint32_t sample, bool first) {
+    if (first) return sample;
+    return avg + (((int32_t)sample - (int32_t)avg) >> PLAN_EWMA_SHIFT);
+}
+
+esp_err_t transfer_plan_init(void) {
+    nvs_handle_t nvs;
+    if (nvs_open(PLAN_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        size_t len = sizeof(calibration);
+        if (nvs_get_blob(nvs, "cal", calibration, &len) != ESP_OK || len != sizeof(calibration)) {
+            memset(calibration, 0, sizeof(calibration));
+        }
+        nvs_close(nvs);
+    }
+    return ESP_OK;
+}
+
+uint32_t can_frame_bits(uint8_t dlc, bool extended, bool worst) {
+    // SOF, arbitration, control, data and CRC are subject to stuffing
+    uint32_t stuffed = 1 + 11 + 1 + 6 + 8 * dlc + 15; // SOF, base ID, RTR, IDE + r0 + DLC
+    if (extended) stuffed += 1 + 18 + 1;             // SRR, ID extension, r1
+    uint32_t stuff_bits = worst ? (stuffed - 1) / 4 : 0;
+    return stuffed + stuff_bits + FRAME_TAIL_BITS;
+}
+
+static uint32_t frame_us(uint32_t bitrate, bool worst) {
+    return (uint64_t)can_frame_bits(8, true, worst) * 1000000 / bitrate;
+}
+
+void transfer_plan_params(can_transport_kind_t kind, size_t image_len, plan_params_t *p) {
+    p->image_len = image_len;
+    p->bitrate = PLAN_DEFAULT_BITRATE;
+    p->burst_frames = BURST_FRAMES;
+    p->framing = DATA_FRAMING_LEGACY;
+    if (kind < CAN_TRANSPORT_COUNT && calibration[kind].sessions) {
+        p->bms = calibration[kind];
+        return;
+    }
+    // Start/size/handshake out, handshake and start back, start/size out again.
+    // Uncalibrated, assume a BMS that only becomes ready at the probe bounds,
+    // with the configured flash geometry.
+    flash_geometry_t geometry;
+    flash_geometry_config(&geometry);
+    p->bms = (plan_calibration_t){
+        .handshake_ms = 2 * (INIT_DELAY + START_DELAY) + 2 * DEFAULT_BMS_REPLY_MS,
+        .turnaround_us = DEFAULT_TURNAROUND_US,
+        .page_bytes = geometry.page_bytes,
+        .page_write_ms = geometry.write_ms,
+    };
+}
+
+void transfer_plan_estimate(const plan_params_t *p, plan_estimate_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (p->bitrate == 0 || p->burst_frames == 0) return;
+
+    uint32_t payload = p->framing == DATA_FRAMING_FULL ? FRAME_PAYLOAD_FULL : FRAME_PAYLOAD;
+    uint32_t burst_bytes = p->burst_frames * payload;
+    uint32_t data_frames = (p->image_len + payload - 1) / payload;
+    out->bursts = (p->image_len + burst_bytes - 1) / burst_bytes;
+    out->frame_us = frame_us(p->bitrate, false);
+    out->frame_worst_us = frame_us(p->bitrate, true);
+
+    // Every burst is a BMS request, the data frames (and burst CRC) and a BMS complete
+    uint32_t per_burst = p->framing == DATA_FRAMING_FULL ? 3 : 2;
+    uint32_t frames = data_frames + per_burst * out->bursts;
+    uint64_t airtime_us = (uint64_t)frames * out->frame_us;
+    uint64_t airtime_worst_us = (uint64_t)frames * out->frame_worst_us;
+    uint64_t turnaround_us = (uint64_t)out->bursts * p->bms.turnaround_us;
+
+    uint32_t pages = p->bms.page_bytes ? (p->image_len + p->bms.page_bytes / 2) / p->bms.page_bytes : 0;
+    uint64_t flash_us = (uint64_t)pages * p->bms.page_write_ms * 1000;
+
+    // A retransmitted frame costs the NACK and the resend
+    uint32_t retx_frames = (uint64_t)p->image_len * p->bms.retx_permille / 1000 / payload;
+    uint64_t retx_us = (uint64_t)retx_frames * 2 * out->frame_us;
+
+    uint64_t verify_us = 0;
+#if CONFIG_BMS_OTA_VERIFY_IMAGE_CRC
+    verify_us = 2 * out->frame_us + p->bms.turnaround_us;
+#endif
+
+    out->handshake_ms = p->bms.handshake_ms;
+    out->airtime_ms = airtime_us / 1000;
+    out->airtime_worst_ms = airtime_worst_us / 1000;
+    out->turnaround_ms = turnaround_us / 1000;
+    out->flash_ms = flash_us / 1000;
+    out->retx_ms = retx_us / 1000;
+    out->verify_ms = verify_us / 1000;
+
+    uint64_t rest_us = turnaround_us + flash_us + retx_us + verify_us + (uint64_t)p->bms.handshake_ms * 1000;
+    out->total_ms = (rest_us + airtime_us) / 1000;
+    out->total_worst_ms = (rest_us + airtime_worst_us + retx_frames * 2 * (out->frame_worst_us - out->frame_us)) / 1000;
+}
+
+void transfer_plan_calibrate(can_transport_kind_t kind, size_t image_len, volatile const ota_metrics_t *m) {
+    if (kind >= CAN_TRANSPORT_COUNT || image_len == 0 || m->bursts == 0) return;
+
+    plan_calibration_t *c = &calibration[kind];
+    bool first = c->sessions == 0;
+
+    // Airtime is modelled separately, the rest of a cycle is the BMS and gateway turnaround
+    uint32_t burst_airtime_us = (BURST_FRAMES + 2) * frame_us(PLAN_DEFAULT_BITRATE, false);
+    uint64_t busy_us = (uint64_t)(m->transfer_ms > m->flash_pause_ms ? m->transfer_ms - m->flash_pause_ms : 0) * 1000;
+    uint32_t cycle_us = busy_us / m->bursts;
+    uint32_t turnaround_us = cycle_us > burst_airtime_us ? cycle_us - burst_airtime_us : 0;
+
+    c->handshake_ms = ewma_u32(c->handshake_ms, m->handshake_ms, first);
+    c->turnaround_us = ewma_u32(c->turnaround_us, turnaround_us, first);
+    c->retx_permille = ewma_u32(c->retx_permille, (uint64_t)m->retransmit_bytes * 1000 / image_len, first);
+    if (m->flash_pauses) {
+        c->page_bytes = ewma_u32(c->page_bytes, image_len / m->flash_pauses, first || c->page_bytes == 0);
+        c->page_write_ms = ewma_u32(c->page_write_ms, m->flash_pause_ms / m->flash_pauses, first || c->page_write_ms == 0);
+    }
+    c->sessions++;
+    save_calibration();
+
+    ESP_LOGI(TAG, "%s calibration (%ld sessions): handshake %ld ms, turnaround %ld us, page %ld B / %ld ms",
+             can_transport_name(kind), c->sessions, c->handshake_ms, c->turnaround_us, c->page_bytes, c->page_write_ms);
+}
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_crc.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "app_shared.h"
+#include "can_manager.h"
+#include "isotp.h"
+#include "ota_status.h"
+#include "uds_client.h"
+#include "session_arena.h"
+
+static const char *TAG = "UDS";
+
+// --- SERVICES ---
+#define SID_SESSION_CONTROL 0x10
+#define SID_ECU_RESET 0x11
+#define SID_ROUTINE_CONTROL 0x31
+#define SID_REQUEST_DOWNLOAD 0x34
+#define SID_TRANSFER_DATA 0x36
+#define SID_TRANSFER_EXIT 0x37
+#define SID_NEGATIVE_RESPONSE 0x7F
+#define POSITIVE_RESPONSE(sid) ((sid) + 0x40)
+
+#define NRC_RESPONSE_PENDING 0x78
+#define SESSION_PROGRAMMING 0x02
+#define RESET_HARD 0x01
+#define ROUTINE_START 0x01
+#define ROUTINE_ERASE_MEMORY 0xFF00
+#define ROUTINE_CHECK_MEMORY 0x0202
+
+#define ADDR_LEN_FORMAT 0x44 // 4-byte address, 4-byte size
+#define UDS_P2_TIMEOUT 1000       // ms to the first response
+#define UDS_P2_STAR_TIMEOUT 5000  // ms after each responsePending
+
+static isotp_link_t link;
+static uint8_t resp[32];
+static size_t resp_len = 0;
+static ota_status_t live_status;
+
+static void publish(ota_state_t state, ota_error_t error) {
+    live_status.state = state;
+    live_status.error = error;
+    ota_status_publish(&live_status);
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+// Sends `req` and waits for its positive response, riding out responsePending.
+// ESP_ERR_INVALID_RESPONSE on a negative response, ESP_ERR_TIMEOUT if the ECU is silent.
+static esp_err_t uds_request(const uint8_t *req, size_t len) {
+    esp_err_t err = isotp_send(&link, req, len);
+    if (err != ESP_OK) return err;
+
+    TickType_t timeout = pdMS_TO_TICKS(UDS_P2_TIMEOUT);
+    while ((err = isotp_receive(&link, resp, sizeof(resp), &resp_len, timeout)) == ESP_OK) {
+        if (resp[0] == POSITIVE_RESPONSE(req[0])) return ESP_OK;
+        if (resp[0] != SID_NEGATIVE_RESPONSE || resp_len < 3 || resp[1] != req[0]) continue;
+
+        if (resp[2] == NRC_RESPONSE_PENDING) {
+            ota_metrics.uds_pending++;
+            timeout = pdMS_TO_TICKS(UDS_P2_STAR_TIMEOUT);
+            continue;
+        }
+        ESP_LOGE(TAG, "Service 0x%02X rejected, NRC 0x%02X", req[0], resp[2]);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    ESP_LOGE(TAG, "No response to service 0x%02X", req[0]);
+    return err;
+}
+
+static esp_err_t start_routine(uint16_t routine, const uint8_t *option, size_t option_len) {
+    uint8_t req[16] = { SID_ROUTINE_CONTROL, ROUTINE_START, routine >> 8, routine & 0xFF };
+    memcpy(req + 4, option, option_len);
+    return uds_request(req, 4 + option_len);
+}
+
+// RequestDownload. Returns the ECU's maxNumberOfBlockLength (SID + counter + data).
+static esp_err_t request_download(size_t len, uint32_t *max_block_len) {
+    uint8_t req[11] = { SID_REQUEST_DOWNLOAD, 0x00, ADDR_LEN_FORMAT };
+    put_be32(req + 3, CONFIG_BMS_UDS_MEMORY_ADDRESS);
+    put_be32(req + 7, len);
+    esp_err_t err = uds_request(req, sizeof(req));
+    if (err != ESP_OK) return err;
+
+    uint8_t n = resp[1] >> 4;
+    if (n == 0 || n > 4 || resp_len < 2u + n) return ESP_ERR_INVALID_RESPONSE;
+    *max_block_len = 0;
+    for (int i = 0; i < n; i++) *max_block_len = (*max_block_len << 8) | resp[2 + i];
+    return (*max_block_len > 2) ? ESP_OK : ESP_ERR_INVALID_RESPONSE;
+}
+
+static ota_error_t error_for(esp_err_t err) {
+    if (err == ESP_ERR_TIMEOUT) return OTA_ERR_BMS_TIMEOUT;
+    if (err == ESP_ERR_INVALID_RESPONSE) return OTA_ERR_UDS_REJECTED;
+    return OTA_ERR_TRANSPORT;
+}
+
+static esp_err_t download(const uint8_t *image, size_t len) {
+    uint8_t req[10];
+    esp_err_t err;
+
+    req[0] = SID_SESSION_CONTROL;
+    req[1] = SESSION_PROGRAMMING;
+    if ((err = uds_request(req, 2)) != ESP_OK) return err;
+    publish(OTA_STATE_HANDSHAKE_OK, OTA_ERR_NONE);
+
+    uint8_t erase[9] = { ADDR_LEN_FORMAT };
+    put_be32(erase + 1, CONFIG_BMS_UDS_MEMORY_ADDRESS);
+    put_be32(erase + 5, len);
+    if ((err = start_routine(ROUTINE_ERASE_MEMORY, erase, sizeof(erase))) != ESP_OK) return err;
+
+    uint32_t max_block_len;
+    if ((err = request_download(len, &max_block_len)) != ESP_OK) return err;
+    // The whole block is held in RAM, so it is capped by the ISO-TP segment length
+    uint32_t block_len = max_block_len;
+    if (block_len > CONFIG_BMS_ISOTP_SEGMENT_LEN) block_len = CONFIG_BMS_ISOTP_SEGMENT_LEN;
+    ota_metrics.uds_block_len = block_len;
+    ESP_LOGI(TAG, "ECU block length %ld, using %ld", max_block_len, block_len);
+
+    uint8_t *block = session_arena_scratch_alloc(block_len);
+    if (!block) return ESP_ERR_NO_MEM;
+
+    live_status.phase = OTA_PHASE_SENDING;
+    publish(OTA_STATE_FLASHING, OTA_ERR_NONE);
+    int64_t start_us = esp_timer_get_time();
+    uint8_t counter = 1;
+    size_t pos = 0;
+    while (pos < len) {
+        size_t chunk = len - pos;
+        if (chunk > block_len - 2) chunk = block_len - 2;
+        block[0] = SID_TRANSFER_DATA;
+        block[1] = counter;
+        memcpy(block + 2, image + pos, chunk);
+
+        // Each block is streamed as one ISO-TP message, paced only by the ECU's flow control
+        if ((err = uds_request(block, chunk + 2)) != ESP_OK) break;
+        if (resp_len < 2 || resp[1] != counter) {
+            ESP_LOGE(TAG, "Block %d acknowledged as %d", counter, resp_len >= 2 ? resp[1] : -1);
+            err = ESP_ERR_INVALID_RESPONSE;
+            break;
+        }
+
+        pos += chunk;
+        counter++; // Wraps 0xFF -> 0x00 as ISO 14229 requires
+        float elapsed_s = (esp_timer_get_time() - start_us) / 1e6f;
+        live_status.sent = pos;
+        live_status.goodput_bps = pos / elapsed_s;
+        live_status.frame_rate = link.frames_sent / elapsed_s;
+        live_status.eta_s = live_status.goodput_bps ? (len - pos) / live_status.goodput_bps : 0;
+        publish(OTA_STATE_FLASHING, OTA_ERR_NONE);
+    }
+    if (err != ESP_OK) return err;
+
+    req[0] = SID_TRANSFER_EXIT;
+    if ((err = uds_request(req, 1)) != ESP_OK) return err;
+
+    live_status.phase = OTA_PHASE_VERIFY;
+    publish(OTA_STATE_VERIFYING, OTA_ERR_NONE);
+    uint8_t crc[4];
+    put_be32(crc, esp_crc32_le(0, image, len));
+    if ((err = start_routine(ROUTINE_CHECK_MEMORY, crc, sizeof(crc))) != ESP_OK) return err;
+    // routineStatusRecord: 0 = correct
+    if (resp_len < 5 || resp[4] != 0) {
+        ESP_LOGE(TAG, "ECU reports image check failed");
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    req[0] = SID_ECU_RESET;
+    req[1] = RESET_HARD;
+    return uds_request(req, 2);
+}
+
+esp_err_t run_uds_update(const uint8_t *image, size_t len, can_transport_kind_t kind) {
+    const can_transport_t *transport = can_transport_get(kind);
+    ESP_LOGI(TAG, "UDS download of %d bytes over %s", len, transport->name);
+
+    memset((void *)&ota_metrics, 0, sizeof(ota_metrics));
+    session_arena_scratch_reset();
+    live_status = (ota_status_t){ .busy = true, .total = len, .phase = OTA_PHASE_HANDSHAKE,
+                                  .transport = kind, .protocol = OTA_PROTOCOL_UDS };
+    publish(OTA_STATE_INITIALIZING, OTA_ERR_NONE);
+
+    esp_err_t err = transport->open(len, CONFIG_BMS_ISOTP_RESPONSE_ID);
+    if (err == ESP_OK) {
+        isotp_link_init(&link, transport, CONFIG_BMS_ISOTP_REQUEST_ID, CONFIG_BMS_ISOTP_RESPONSE_ID);
+        err = download(image, len);
+        ota_metrics.frames_sent = link.frames_sent;
+        transport->close();
+    }
+
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG, "Download finished successfully");
+        publish(OTA_STATE_SUCCESS, OTA_ERR_NONE);
+    } else {
+        publish(OTA_STATE_FAILED, err == ESP_ERR_INVALID_CRC ? OTA_ERR_VERIFY_MISMATCH : error_for(err));
+    }
+    accumulate_metrics();
+
+    live_status.busy = false;
+    live_status.phase = OTA_PHASE_IDLE;
+    ota_status_publish(&live_status);
+    return err;
+}
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "mbedtls/sha256.h"
+
+#include "upload_session.h"
+#include "session_arena.h"
+
+static const char *TAG = "UPLOAD";
+
+static SemaphoreHandle_t session_lock = NULL;
+static upload_session_info_t session = {0};
+static uint8_t *buffer = NULL; // In the stage end of the session arena
+static uint8_t *bitmap = NULL; // One bit per received chunk, right after the buffer
+static uint32_t next_id = 1;
+
+// --- HELPERS (call with session_lock held) ---
+
+static bool chunk_done(uint32_t idx) {
+    return bitmap[idx / 8] & (1 << (idx % 8));
+}
+
+static void drop_session(void) {
+    buffer = NULL;
+    bitmap = NULL;
+    memset(&session, 0, sizeof(session));
+}
+
+// --- PUBLIC API ---
+
+esp_err_t upload_session_init(void) {
+    session_lock = xSemaphoreCreateMutex();
+    return session_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t upload_session_open(size_t size, size_t chunk_len, uint32_t *out_id) {
+    if (size == 0 || chunk_len < UPLOAD_CHUNK_MIN || chunk_len > UPLOAD_CHUNK_MAX) return ESP_ERR_INVALID_ARG;
+
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    if (session.in_flight) {
+        xSemaphoreGive(session_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    drop_session();
+
+    uint32_t chunks = (size + chunk_len - 1) / chunk_len;
+    buffer = session_arena_stage_alloc(size);
+    bitmap = buffer ? session_arena_stage_alloc((chunks + 7) / 8) : NULL;
+    if (!buffer || !bitmap) {
+        drop_session();
+        xSemaphoreGive(session_lock);
+        ESP_LOGE(TAG, "No room for %d byte session", size);
+        return ESP_ERR_NO_MEM;
+    }
+    memset(bitmap, 0, (chunks + 7) / 8);
+
+    session.id = next_id++;
+    session.size = size;
+    session.chunk_len = chunk_len;
+    session.chunks = chunks;
+    *out_id = session.id;
+    xSemaphoreGive(session_lock);
+
+    ESP_LOGI(TAG, "Session %ld: %d bytes in %ld chunks of %d", *out_id, size, chunks, chunk_len);
+    return ESP_OK;
+}
+
+esp_err_t upload_session_begin_chunk(uint32_t id, size_t start, size_t len, uint8_t **dst) {
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    if (id == 0 || id != session.id) {
+        err = ESP_ERR_NOT_FOUND;
+    } else if (start % session.chunk_len != 0 || start >= session.size) {
+        err = ESP_ERR_INVALID_ARG;
+    } else {
+        size_t expected = session.size - start;
+        if (expected > session.chunk_len) expected = session.chunk_len;
+        if (len != expected) err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        // Two writers of the same chunk carry the same bytes, so overlap is harmless
+        session.in_flight++;
+        *dst = buffer + start;
+    }
+    xSemaphoreGive(session_lock);
+    return err;
+}
+
+void upload_session_end_chunk(uint32_t id, size_t start, bool ok) {
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    if (id == session.id) {
+        session.in_flight--;
+        uint32_t idx = start / session.chunk_len;
+        if (ok && !chunk_done(idx)) {
+            bitmap[idx / 8] |= 1 << (idx % 8);
+            session.received++;
+        }
+    }
+    xSemaphoreGive(session_lock);
+}
+
+void upload_session_get(upload_session_info_t *out) {
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    *out = session;
+    xSemaphoreGive(session_lock);
+}
+
+size_t upload_session_missing(uint32_t *out, size_t max) {
+    size_t n = 0;
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    for (uint32_t i = 0; i < session.chunks && n < max; i++) {
+        if (!chunk_done(i)) out[n++] = i;
+    }
+    xSemaphoreGive(session_lock);
+    return n;
+}
+
+esp_err_t upload_session_finish(uint32_t id, const uint8_t sha256[IMAGE_HASH_LEN], uint8_t **image, size_t *len) {
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    if (id == 0 || id != session.id) {
+        xSemaphoreGive(session_lock);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (session.in_flight || session.received != session.chunks) {
+        xSemaphoreGive(session_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    uint8_t digest[IMAGE_HASH_LEN];
+    mbedtls_sha256(buffer, session.size, digest, 0);
+    if (memcmp(digest, sha256, IMAGE_HASH_LEN) != 0) {
+        // We can't tell which chunk is bad, so every chunk is missing again
+        memset(bitmap, 0, (session.chunks + 7) / 8);
+        session.received = 0;
+        xSemaphoreGive(session_lock);
+        ESP_LOGE(TAG, "Session %ld: digest mismatch", id);
+        return ESP_ERR_INVALID_CRC;
+    }
+
+    *image = buffer;
+    *len = session.size;
+    drop_session();
+    xSemaphoreGive(session_lock);
+    return ESP_OK;
+}
+
+esp_err_t upload_session_abort(void) {
+    xSemaphoreTake(session_lock, portMAX_DELAY);
+    bool busy = session.in_flight != 0;
+    if (!busy) drop_session();
+    xSemaphoreGive(session_lock);
+    return busy ? ESP_ERR_INVALID_STATE : ESP_OK;
+}
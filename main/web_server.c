@@ -10,16 +10,48 @@
 #include "app_shared.h" 
 #include "web_page.h"
 #include "can_manager.h" // Assuming start_can_update_task() is here
+#include "job_queue.h"
+#include "image_cache.h"
+#include "ota_status.h"
+#include "can_capture.h"
+#include "frame_jitter.h"
+#include "upload_session.h"
+#include "transfer_plan.h"
+#include "sparse_image.h"
+#include "session_arena.h"
+#include "sim_bms.h"
+#include "can_protocol.h"
+#include "task_config.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 static const char *TAG = "WEB";
 
+#define CAPTURE_CHUNK_LEN 1024
+#define CAPTURE_MAX_STREAM_S 60
+
 // --- SHARED VARIABLES ---
 volatile bool SYSTEM_IS_BUSY = false;
 uint8_t *firmware_buffer = NULL;
 size_t firmware_len = 0;
-volatile uint32_t ota_total_size = 0;
-volatile uint32_t ota_sent_bytes = 0;
-char ota_status_msg[32] = "Idle";
+volatile ota_metrics_t ota_metrics = {0};
+volatile ota_metrics_t ota_metrics_total = {0};
+
+// Held while firmware_buffer is being replaced or read outside the CAN task
+static SemaphoreHandle_t staging_lock = NULL;
+
+// Upload that finished while firmware_buffer was on the bus, in the arena's next slot
+static uint8_t *next_buffer = NULL;
+static size_t next_len = 0;
+
+// Last hex body received (upload, job or benchmark)
+static uint32_t upload_last_bytes = 0;
+static uint32_t upload_last_us = 0;
+
+#define UPLOAD_BENCH_WINDOW 16384
 
 // Helper to convert hex char to int
 uint8_t hex2int(char c) {
@@ -29,6 +61,130 @@ uint8_t hex2int(char c) {
     return 0;
 }
 
+// Receives a hex-text body straight into dst and decodes it in place. Byte k
+// is written to dst[k] only after its two characters were read at or past
+// that position, so no bounce buffer is needed and dst needs content_len / 2
+// bytes. With wrap set the decoded bytes start over at dst[0] once cap is
+// reached (upload benchmark); out_len still counts every decoded byte.
+static esp_err_t recv_hex_body(httpd_req_t *req, uint8_t *dst, size_t cap, bool wrap, size_t *out_len) {
+    size_t remaining = req->content_len;
+    size_t binary_idx = 0;
+    size_t pos = 0;
+    uint8_t high_nibble = 0;
+    bool have_high = false;
+    int64_t start_us = esp_timer_get_time();
+
+    while (remaining > 0) {
+        if (pos == cap && wrap) pos = 0;
+        if (pos == cap) {
+            // Only an odd trailing character is left; drop it like the old parser did
+            char spare;
+            if (httpd_req_recv(req, &spare, 1) <= 0) return ESP_FAIL;
+            remaining--;
+            continue;
+        }
+
+        char *rx = (char *)dst + pos;
+        size_t want = cap - pos;
+        if (want > remaining) want = remaining;
+        int received = httpd_req_recv(req, rx, want);
+        if (received <= 0) return ESP_FAIL;
+
+        // Parse Hex Stream
+        for (int i = 0; i < received; i++) {
+            if (!have_high) {
+                high_nibble = hex2int(rx[i]);
+                have_high = true;
+            } else {
+                dst[pos++] = (high_nibble << 4) | hex2int(rx[i]);
+                binary_idx++;
+                have_high = false;
+            }
+        }
+        remaining -= received;
+    }
+
+    upload_last_bytes = req->content_len;
+    upload_last_us = esp_timer_get_time() - start_us;
+    *out_len = binary_idx;
+    return ESP_OK;
+}
+
+// Body bytes per second of the last upload, in KB/s
+static uint32_t upload_kb_per_s(uint32_t bytes, uint32_t elapsed_us) {
+    return elapsed_us ? (uint64_t)bytes * 1000000 / 1024 / elapsed_us : 0;
+}
+
+// --- ASYNC WORKERS ---
+// The httpd task serves one request at a time. Handlers that block for long
+// (body uploads, capture streams) are registered through async_dispatch and
+// run on a worker instead, so status polls and page loads keep flowing.
+
+typedef esp_err_t (*handler_fn_t)(httpd_req_t *req);
+
+typedef struct {
+    httpd_req_t *req; // Detached copy from httpd_req_async_handler_begin()
+    int64_t queued_us;
+} async_req_t;
+
+static QueueHandle_t async_queue = NULL;
+static SemaphoreHandle_t async_idle = NULL; // Counts idle workers
+static uint32_t async_started = 0;
+static uint32_t async_rejected = 0;
+static uint32_t async_wait_max_us = 0;
+
+static void async_worker_task(void *arg) {
+    async_req_t job;
+    while (1) {
+        if (xQueueReceive(async_queue, &job, portMAX_DELAY) != pdTRUE) continue;
+
+        uint32_t wait_us = esp_timer_get_time() - job.queued_us;
+        if (wait_us > async_wait_max_us) async_wait_max_us = wait_us;
+        handler_fn_t handler = (handler_fn_t)job.req->user_ctx;
+        // Like the httpd task on ESP_FAIL: drop the session, an unread body would parse as the next request
+        if (handler(job.req) != ESP_OK) httpd_sess_trigger_close(job.req->handle, httpd_req_to_sockfd(job.req));
+        httpd_req_async_handler_complete(job.req);
+        xSemaphoreGive(async_idle);
+    }
+}
+
+// Registered in place of a long-running handler, which is passed as user_ctx.
+// Never queues more requests than there are idle workers, so a request is
+// either started right away or refused with 503.
+static esp_err_t async_dispatch(httpd_req_t *req) {
+    if (xSemaphoreTake(async_idle, 0) != pdTRUE) {
+        async_rejected++;
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, "Busy", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    async_req_t job = { .queued_us = esp_timer_get_time() };
+    if (httpd_req_async_handler_begin(req, &job.req) != ESP_OK) {
+        xSemaphoreGive(async_idle);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    async_started++;
+    xQueueSend(async_queue, &job, portMAX_DELAY);
+    return ESP_OK;
+}
+
+static esp_err_t start_async_workers(void) {
+    async_queue = xQueueCreate(HTTPD_ASYNC_WORKERS, sizeof(async_req_t));
+    async_idle = xSemaphoreCreateCounting(HTTPD_ASYNC_WORKERS, HTTPD_ASYNC_WORKERS);
+    staging_lock = xSemaphoreCreateMutex();
+    if (!async_queue || !async_idle || !staging_lock) return ESP_ERR_NO_MEM;
+
+    for (int i = 0; i < HTTPD_ASYNC_WORKERS; i++) {
+        if (xTaskCreatePinnedToCore(async_worker_task, "httpd_worker", HTTPD_WORKER_STACK, NULL,
+                                    HTTPD_TASK_PRIORITY, NULL, HTTPD_TASK_CORE) != pdPASS) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
 // --- HANDLERS ---
 
 static esp_err_t root_get_handler(httpd_req_t *req) {
@@ -37,72 +193,87 @@ static esp_err_t root_get_handler(httpd_req_t *req) {
 }
 
 // 1. UPLOAD HANDLER
-static esp_err_t upload_post_handler(httpd_req_t *req) {
-    if (SYSTEM_IS_BUSY) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "System Busy Flashing");
+// Makes the image in the next slot the one /api/flash sends. Deferred while
+// anything owns the bus, since a transfer may be reading firmware_buffer and
+// the swap moves scratch. Call with staging_lock held.
+static bool promote_staged(void) {
+    if (!next_buffer || !ota_claim_bus()) return false;
+    session_arena_stage_swap();
+    firmware_buffer = next_buffer;
+    firmware_len = next_len;
+    next_buffer = NULL;
+    next_len = 0;
+    ota_release_bus();
+    ESP_LOGI(TAG, "Staged image of %d bytes is now active", firmware_len);
+    return true;
+}
+
+// Drops the image waiting in the next slot and any chunked session. While a
+// transfer runs the active image stays and the upload gets what is left of
+// the arena; otherwise the active image is dropped too, so the upload can use
+// all of it. Call with staging_lock held.
+static esp_err_t clear_staging(httpd_req_t *req) {
+    if (upload_session_abort() != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload In Progress");
         return ESP_FAIL;
     }
+    next_buffer = NULL;
+    next_len = 0;
+    session_arena_stage_reset();
+    if (ota_claim_bus()) {
+        session_arena_stage_swap();
+        firmware_buffer = NULL;
+        firmware_len = 0;
+        ota_release_bus();
+    }
+    return ESP_OK;
+}
+
+// Stages a received image and promotes it unless a transfer is running.
+// Call with staging_lock held.
+static void send_staged(httpd_req_t *req, uint8_t *image, size_t len, const char *extra) {
+    next_buffer = image;
+    next_len = len;
+    bool queued = !promote_staged();
+
+    char resp[160];
+    snprintf(resp, sizeof(resp), "{\"size\": %d, %s\"queued\": %s}", len, extra, queued ? "true" : "false");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+}
+
+// Call with staging_lock held
+static esp_err_t stage_upload(httpd_req_t *req) {
+    if (clear_staging(req) != ESP_OK) return ESP_FAIL;
 
-    int total_len = req->content_len;
-    int cur_len = 0;
-    int received = 0;
-    
     // JS cleans the string, so we assume 2 hex chars = 1 byte
-    size_t binary_size = total_len / 2;
+    size_t binary_size = req->content_len / 2;
 
-    if (firmware_buffer) free(firmware_buffer);
-    firmware_buffer = malloc(binary_size);
-    if (!firmware_buffer) {
-        ESP_LOGE(TAG, "OOM");
-        httpd_resp_send_500(req);
+    uint8_t *image = session_arena_stage_alloc(binary_size);
+    if (!image) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Image Too Large");
         return ESP_FAIL;
     }
 
-    char *chunk = malloc(1024);
     size_t binary_idx = 0;
-    char high_nibble = 0;
-    bool have_high = false;
-
-    while (cur_len < total_len) {
-        received = httpd_req_recv(req, chunk, 1024);
-        if (received <= 0) {
-            free(chunk);
-            return ESP_FAIL;
-        }
-
-        // Parse Hex Stream
-        for (int i = 0; i < received; i++) {
-            if (!have_high) {
-                high_nibble = hex2int(chunk[i]);
-                have_high = true;
-            } else {
-                uint8_t low_nibble = hex2int(chunk[i]);
-                firmware_buffer[binary_idx++] = (high_nibble << 4) | low_nibble;
-                have_high = false;
-            }
-        }
-        cur_len += received;
+    if (recv_hex_body(req, image, binary_size, false, &binary_idx) != ESP_OK) {
+        session_arena_stage_reset();
+        return ESP_FAIL;
     }
-    free(chunk);
-
-    firmware_len = binary_idx;
-    ota_total_size = firmware_len;
-    
-    // ... (This is inside upload_post_handler, after firmware_len is set) ...
 
-    ESP_LOGI(TAG, "Stored %d bytes. Starting Verification...", firmware_len);
+    ESP_LOGI(TAG, "Stored %d bytes. Starting Verification...", binary_idx);
 
     // --- START VERIFICATION LOGIC ---
     
     // 1. Check Size
     size_t expected_size = sizeof(EXPECTED_DATA);
     
-    if (firmware_len != expected_size) {
-        ESP_LOGE(TAG, "SIZE MISMATCH! Expected: %d, Got: %d", expected_size, firmware_len);
+    if (binary_idx != expected_size) {
+        ESP_LOGE(TAG, "SIZE MISMATCH! Expected: %d, Got: %d", expected_size, binary_idx);
     } 
     else {
         // 2. Check Content (Fast Compare)
-        int result = memcmp(firmware_buffer, EXPECTED_DATA, firmware_len);
+        int result = memcmp(image, EXPECTED_DATA, binary_idx);
         
         if (result == 0) {
             // SUCCESS
@@ -114,11 +285,11 @@ static esp_err_t upload_post_handler(httpd_req_t *req) {
             // FAILURE - FIND THE EXACT ERROR
             ESP_LOGE(TAG, "❌ DATA CONTENT MISMATCH! Finding first error...");
             
-            for (size_t i = 0; i < firmware_len; i++) {
-                if (firmware_buffer[i] != EXPECTED_DATA[i]) {
+            for (size_t i = 0; i < binary_idx; i++) {
+                if (image[i] != EXPECTED_DATA[i]) {
                     ESP_LOGE(TAG, "Error at Index [%d] (Address 0x%X)", i, i);
                     ESP_LOGE(TAG, " -> Expected: 0x%02X", EXPECTED_DATA[i]);
-                    ESP_LOGE(TAG, " -> Received: 0x%02X", firmware_buffer[i]);
+                    ESP_LOGE(TAG, " -> Received: 0x%02X", image[i]);
                     break; // Stop at first error to avoid spamming
                 }
             }
@@ -126,34 +297,138 @@ static esp_err_t upload_post_handler(httpd_req_t *req) {
     }
     // --- END VERIFICATION LOGIC ---
 
-    char resp[64];
-    
-    snprintf(resp, 64, "{\"size\": %d}", firmware_len);
+    char timing[64];
+    snprintf(timing, sizeof(timing), "\"elapsed_us\": %ld, \"kb_per_s\": %ld, ",
+             upload_last_us, upload_kb_per_s(upload_last_bytes, upload_last_us));
+    send_staged(req, image, binary_idx, timing);
+    return ESP_OK;
+}
+
+// Reads ?transport=twai|loopback|sim&protocol=legacy|uds|lzss|sparse, defaulting to legacy on the real bus
+static bool query_transport(httpd_req_t *req, can_transport_kind_t *kind, ota_protocol_t *protocol) {
+    char query[96];
+    char name[16];
+    *kind = CAN_TRANSPORT_TWAI;
+    *protocol = OTA_PROTOCOL_LEGACY;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) return true;
+    if (httpd_query_key_value(query, "transport", name, sizeof(name)) == ESP_OK && !can_transport_from_name(name, kind)) return false;
+    if (httpd_query_key_value(query, "protocol", name, sizeof(name)) == ESP_OK && !ota_protocol_from_name(name, protocol)) return false;
+    return true;
+}
+
+// Reads ?caps=<BMS_CAP_* bits>&burst=<frames>, what the simulated BMS offers for
+// one session. Defaults when absent; false for the real bus or a burst above MAX_BURST_FRAMES.
+static bool query_sim_caps(httpd_req_t *req, can_transport_kind_t kind, uint8_t *caps, uint8_t *burst) {
+    char query[128];
+    char value[8];
+    bool given = false;
+    *caps = SIM_BMS_CAPS;
+    *burst = SIM_BMS_BURST;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) return true;
+    if (httpd_query_key_value(query, "caps", value, sizeof(value)) == ESP_OK) {
+        *caps = strtoul(value, NULL, 0);
+        given = true;
+    }
+    if (httpd_query_key_value(query, "burst", value, sizeof(value)) == ESP_OK) {
+        unsigned long frames = strtoul(value, NULL, 0);
+        if (frames > MAX_BURST_FRAMES) return false;
+        *burst = frames;
+        given = true;
+    }
+    return !given || kind != CAN_TRANSPORT_TWAI;
+}
+
+// Reads ?align=0, which sends fixed bursts instead of page-aligned ones for one session
+static bool query_page_align(httpd_req_t *req) {
+    char query[128];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) return true;
+    return httpd_query_key_value(query, "align", value, sizeof(value)) != ESP_OK || atoi(value) != 0;
+}
+
+// POST /api/upload?bench=1
+// Same receive and decode path as a real upload, but into a small window that
+// is overwritten as it fills, so bodies larger than free RAM can be timed.
+// The staged image is left alone.
+static esp_err_t upload_bench(httpd_req_t *req) {
+    uint8_t *window = malloc(UPLOAD_BENCH_WINDOW);
+    if (!window) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    size_t decoded = 0;
+    esp_err_t err = recv_hex_body(req, window, UPLOAD_BENCH_WINDOW, true, &decoded);
+    free(window);
+    if (err != ESP_OK) return ESP_FAIL;
+
+    char resp[128];
+    snprintf(resp, sizeof(resp), "{\"bytes\": %ld, \"decoded\": %d, \"elapsed_us\": %ld, \"kb_per_s\": %ld}",
+             upload_last_bytes, decoded, upload_last_us, upload_kb_per_s(upload_last_bytes, upload_last_us));
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, resp, strlen(resp));
     return ESP_OK;
 }
 
+// Runs on an async worker; a second upload is refused rather than queued
+static esp_err_t upload_post_handler(httpd_req_t *req) {
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "bench", value, sizeof(value)) == ESP_OK && atoi(value)) {
+        return upload_bench(req);
+    }
+
+    if (xSemaphoreTake(staging_lock, 0) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload In Progress");
+        return ESP_FAIL;
+    }
+    esp_err_t res = stage_upload(req);
+    xSemaphoreGive(staging_lock);
+    return res;
+}
+
 // 2. FLASH TRIGGER HANDLER
-static esp_err_t flash_post_handler(httpd_req_t *req) {
+// POST /api/flash?transport=twai|loopback|sim&protocol=legacy|uds|lzss|sparse[&caps=<bits>&burst=<frames>][&align=0]
+// Call with staging_lock held
+static esp_err_t start_flash(httpd_req_t *req) {
+    promote_staged();
     if (!firmware_buffer || firmware_len == 0) {
         httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No Data");
         return ESP_FAIL;
     }
 
-    if (SYSTEM_IS_BUSY) {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Already running");
+    can_transport_kind_t kind;
+    ota_protocol_t protocol;
+    if (!query_transport(req, &kind, &protocol)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown Transport Or Protocol");
+        return ESP_FAIL;
+    }
+
+    // Raw streams are announced in 16 bits; an LZSS stream is checked once compressed
+    bool raw = protocol == OTA_PROTOCOL_LEGACY || protocol == OTA_PROTOCOL_SPARSE;
+    if (raw && firmware_len > MAX_STREAM_LEN) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Image Too Large For Legacy Protocol");
         return ESP_FAIL;
     }
 
-    // LOCK THE SYSTEM
-    SYSTEM_IS_BUSY = true;
-    ota_sent_bytes = 0;
-    strcpy(ota_status_msg, "Starting...");
+    uint8_t sim_caps, sim_burst;
+    if (!query_sim_caps(req, kind, &sim_caps, &sim_burst)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid Simulated BMS Caps");
+        return ESP_FAIL;
+    }
+
+    // LOCK THE SYSTEM (takes the bus over from a running capture)
+    if (!ota_claim_bus()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Already running");
+        return ESP_FAIL;
+    }
+    // Only while we own the bus: a running session may be asking the simulated BMS right now
+    if (kind != CAN_TRANSPORT_TWAI) sim_bms_set_caps(sim_caps, sim_burst);
 
     // Start CAN Task (Ensure this function is defined in can_manager.c)
-    if (start_can_update_task() != ESP_OK) {
-        SYSTEM_IS_BUSY = false;
+    if (start_can_update_task(kind, protocol, query_page_align(req)) != ESP_OK) {
+        ota_release_bus();
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
@@ -163,30 +438,678 @@ static esp_err_t flash_post_handler(httpd_req_t *req) {
     return ESP_OK;
 }
 
+static esp_err_t flash_post_handler(httpd_req_t *req) {
+    // An upload on a worker may be replacing firmware_buffer right now
+    if (xSemaphoreTake(staging_lock, 0) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload In Progress");
+        return ESP_FAIL;
+    }
+    esp_err_t res = start_flash(req);
+    xSemaphoreGive(staging_lock);
+    return res;
+}
+
 // 3. STATUS HANDLER
 static esp_err_t status_get_handler(httpd_req_t *req) {
-    char resp[128];
-    snprintf(resp, 128, "{\"busy\": %s, \"status\": \"%s\", \"sent\": %ld, \"total\": %ld}",
-             SYSTEM_IS_BUSY ? "true" : "false",
-             ota_status_msg,
-             ota_sent_bytes,
-             ota_total_size);
+    ota_status_t st;
+    ota_status_read(&st);
+
+    char resp[576];
+    snprintf(resp, sizeof(resp), "{\"busy\": %s, \"state\": \"%s\", \"code\": %d, \"error\": \"%s\", \"sent\": %ld, \"total\": %ld, \"retries\": %ld, \"retx_bytes\": %ld, "
+             "\"phase\": \"%s\", \"goodput_bps\": %ld, \"frames_per_s\": %ld, \"burst_rtt_us\": %ld, \"flash_pause_us\": %ld, \"eta_s\": %ld, \"transport\": \"%s\", \"protocol\": \"%s\"}",
+             st.busy ? "true" : "false",
+             ota_state_name(st.state),
+             st.error,
+             ota_error_name(st.error),
+             st.sent,
+             st.total,
+             st.retries,
+             st.retransmit_bytes,
+             ota_phase_name(st.phase),
+             st.goodput_bps,
+             st.frame_rate,
+             st.burst_rtt_us,
+             st.flash_pause_us,
+             st.eta_s,
+             can_transport_name(st.transport),
+             ota_protocol_name(st.protocol));
     
     httpd_resp_set_type(req, "application/json");
     httpd_resp_send(req, resp, strlen(resp));
     return ESP_OK;
 }
 
+// 4. METRICS HANDLER
+static int metrics_to_json(char *buf, size_t len, volatile const ota_metrics_t *m) {
+    return snprintf(buf, len, "{\"sessions\": %ld, \"frames\": %ld, \"tx_failures\": %ld, \"nacks\": %ld, \"retries\": %ld, \"retx_bytes\": %ld, "
+                    "\"rx_missed\": %ld, \"rx_overrun\": %ld, \"hw_filter\": %ld, \"ack_latency_max_us\": %ld, "
+                    "\"bus_off\": %ld, \"bus_recoveries\": %ld, \"err_passive\": %ld, \"rx_queue_full\": %ld, \"arb_lost\": %ld, \"resyncs\": %ld, "
+                    "\"uds_block_len\": %ld, \"uds_pending\": %ld, \"bursts\": %ld, \"flash_pauses\": %ld, \"flash_pause_ms\": %ld, \"flash_busy\": %ld, \"page_blocks\": %ld, "
+                    "\"handshake_ms\": %ld, \"handshake_probes\": %ld, \"bms_ready_ms\": %ld, \"start_ready_ms\": %ld, "
+                    "\"transfer_ms\": %ld, \"image_bytes\": %ld, \"goodput_bps\": %ld, \"stream_bytes\": %ld, \"fill_frames\": %ld, \"fill_bytes\": %ld, \"full_frames\": %ld}",
+                    m->sessions, m->frames_sent, m->tx_failures, m->nacks, m->retries, m->retransmit_bytes,
+                    m->rx_missed, m->rx_overrun, m->hw_filter_sessions, m->ack_latency_max_us,
+                    m->bus_off, m->bus_recoveries, m->err_passive, m->rx_queue_full, m->arb_lost, m->resyncs,
+                    m->uds_block_len, m->uds_pending, m->bursts, m->flash_pauses, m->flash_pause_ms, m->flash_busy, m->page_blocks,
+                    m->handshake_ms, m->handshake_probes, m->bms_ready_ms, m->start_ready_ms,
+                    m->transfer_ms, m->image_bytes, m->transfer_ms ? (uint32_t)((uint64_t)m->image_bytes * 1000 / m->transfer_ms) : 0, m->stream_bytes, m->fill_frames, m->fill_bytes, m->full_frame_sessions);
+}
+
+static esp_err_t metrics_get_handler(httpd_req_t *req) {
+    char resp[2880];
+    int n = snprintf(resp, sizeof(resp), "{\"session\": ");
+    n += metrics_to_json(resp + n, sizeof(resp) - n, &ota_metrics);
+    n += snprintf(resp + n, sizeof(resp) - n, ", \"total\": ");
+    n += metrics_to_json(resp + n, sizeof(resp) - n, &ota_metrics_total);
+
+    capture_stats_t cap;
+    can_capture_get_stats(&cap);
+    n += snprintf(resp + n, sizeof(resp) - n, ", \"capture\": {\"active\": %s, \"captured\": %ld, \"dropped\": %ld, \"filtered\": %ld, \"rx_missed\": %ld, \"rx_overrun\": %ld}",
+                  cap.active ? "true" : "false", cap.captured, cap.dropped, cap.filtered, cap.rx_missed, cap.rx_overrun);
+
+    sim_bms_flash_stats_t sim;
+    sim_bms_flash_stats(&sim);
+    n += snprintf(resp + n, sizeof(resp) - n, ", \"sim_flash\": {\"pages\": %ld, \"stalls\": %ld, \"busy_replies\": %ld}",
+                  sim.pages, sim.stalls, sim.busy_replies);
+
+    frame_jitter_report_t jit;
+    frame_jitter_report(&jit);
+    n += snprintf(resp + n, sizeof(resp) - n, ", \"frame_gap_us\": {\"samples\": %ld, \"p50\": %ld, \"p90\": %ld, \"p99\": %ld, \"max\": %ld}",
+                  jit.samples, jit.p50_us, jit.p90_us, jit.p99_us, jit.max_us);
+
+    session_arena_stats_t mem;
+    session_arena_stats(&mem);
+    n += snprintf(resp + n, sizeof(resp) - n, ", \"memory\": {\"arena\": %ld, \"stage_used\": %ld, \"next_used\": %ld, \"scratch_used\": %ld, \"scratch_peak\": %ld, "
+                  "\"arena_failures\": %ld, \"heap_free\": %ld, \"heap_min_free\": %ld, \"largest_block\": %ld, \"largest_block_min\": %ld}",
+                  mem.size, mem.stage_used, mem.next_used, mem.scratch_used, mem.scratch_peak, mem.failures,
+                  mem.heap_free, mem.heap_min_free, mem.largest_block, mem.largest_block_min);
+
+    snprintf(resp + n, sizeof(resp) - n, ", \"http\": {\"async_started\": %ld, \"async_rejected\": %ld, \"async_wait_max_us\": %ld, "
+             "\"upload_bytes\": %ld, \"upload_us\": %ld, \"upload_kb_per_s\": %ld}}",
+             async_started, async_rejected, async_wait_max_us,
+             upload_last_bytes, upload_last_us, upload_kb_per_s(upload_last_bytes, upload_last_us));
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+// Copies the last path segment of the URI (without query string) into out
+static void uri_last_segment(httpd_req_t *req, char *out, size_t len) {
+    const char *seg = strrchr(req->uri, '/');
+    seg = seg ? seg + 1 : req->uri;
+    size_t n = strcspn(seg, "?");
+    if (n >= len) n = len - 1;
+    memcpy(out, seg, n);
+    out[n] = '\0';
+}
+
+// 5. JOB HANDLERS
+// POST /api/jobs?target=<name>&label=<name>  body: hex image, same format as /api/upload
+// POST /api/jobs?target=<name>&hash=<sha256> with no body queues an already cached image
+// Either form takes &transport=twai|loopback|sim to benchmark without a pack,
+// &protocol=legacy|uds|lzss|sparse for the bootloader the unit runs and &align=0
+static esp_err_t jobs_post_handler(httpd_req_t *req) {
+    char target[JOB_TARGET_LEN] = "";
+    char label[IMAGE_LABEL_LEN] = "";
+    char hash_hex[IMAGE_HASH_LEN * 2 + 1] = "";
+    char query[256];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        httpd_query_key_value(query, "target", target, sizeof(target));
+        httpd_query_key_value(query, "label", label, sizeof(label));
+        httpd_query_key_value(query, "hash", hash_hex, sizeof(hash_hex));
+    }
+
+    can_transport_kind_t kind;
+    ota_protocol_t protocol;
+    if (!query_transport(req, &kind, &protocol)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown Transport Or Protocol");
+        return ESP_FAIL;
+    }
+    bool page_align = query_page_align(req);
+
+    uint8_t hash[IMAGE_HASH_LEN];
+    uint32_t id = 0;
+    esp_err_t err;
+    size_t image_len = 0;
+
+    if (req->content_len == 0 && hash_hex[0]) {
+        // Flash from cache: no upload at all
+        image_cache_entry_t entry;
+        if (!image_hash_from_hex(hash_hex, hash) || image_cache_lookup(hash, &entry) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Image Not Cached");
+            return ESP_FAIL;
+        }
+        image_len = entry.size;
+        err = job_queue_add_cached(hash, image_len, target, kind, protocol, page_align, &id);
+    } else {
+        size_t binary_size = req->content_len / 2;
+        if (binary_size == 0) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No Data");
+            return ESP_FAIL;
+        }
+
+        uint8_t *image = malloc(binary_size);
+        if (!image) {
+            ESP_LOGE(TAG, "OOM");
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+
+        if (recv_hex_body(req, image, binary_size, false, &image_len) != ESP_OK) {
+            free(image);
+            return ESP_FAIL;
+        }
+
+        // An image cached earlier needs no RAM copy. Otherwise the scheduler keeps a copy
+        // in flash so the next unit needs no upload; it writes it between transfers.
+        image_hash(image, image_len, hash);
+        if (image_cache_lookup(hash, NULL) == ESP_OK) {
+            free(image);
+            err = job_queue_add_cached(hash, image_len, target, kind, protocol, page_align, &id);
+        } else {
+            err = job_queue_add(image, image_len, target, kind, protocol, page_align, label, &id);
+        }
+    }
+
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Job Queue Full");
+        return ESP_FAIL;
+    }
+
+    image_hash_to_hex(hash, hash_hex);
+    char resp[128];
+    snprintf(resp, sizeof(resp), "{\"id\": %ld, \"size\": %d, \"hash\": \"%s\"}", id, image_len, hash_hex);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+static esp_err_t jobs_get_handler(httpd_req_t *req) {
+    job_info_t list[JOB_QUEUE_LEN];
+    size_t count = job_queue_list(list, JOB_QUEUE_LEN);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, "[");
+    for (size_t i = 0; i < count; i++) {
+        char item[224];
+        snprintf(item, sizeof(item), "%s{\"id\": %ld, \"target\": \"%s\", \"size\": %d, \"transport\": \"%s\", \"protocol\": \"%s\", \"state\": \"%s\", \"result\": \"%s\"}",
+                 i ? ", " : "", list[i].id, list[i].target, list[i].size, can_transport_name(list[i].transport), ota_protocol_name(list[i].protocol),
+                 job_state_name(list[i].state), list[i].result);
+        httpd_resp_sendstr_chunk(req, item);
+    }
+    httpd_resp_sendstr_chunk(req, "]");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+// DELETE /api/jobs/{id}
+static esp_err_t jobs_delete_handler(httpd_req_t *req) {
+    char id_str[12];
+    uri_last_segment(req, id_str, sizeof(id_str));
+    uint32_t id = strtoul(id_str, NULL, 10);
+
+    esp_err_t err = job_queue_remove(id);
+    if (err == ESP_ERR_NOT_FOUND) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No Such Job");
+        return ESP_FAIL;
+    }
+    if (err == ESP_ERR_INVALID_STATE) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Job Is Flashing");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\": \"deleted\"}", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+// 6. IMAGE CACHE HANDLERS
+static int cache_entry_to_json(char *buf, size_t len, const image_cache_entry_t *e) {
+    char hash_hex[IMAGE_HASH_LEN * 2 + 1];
+    image_hash_to_hex(e->hash, hash_hex);
+    return snprintf(buf, len, "{\"hash\": \"%s\", \"size\": %ld, \"label\": \"%s\", \"last_use\": %ld}",
+                    hash_hex, e->size, e->label, e->last_use);
+}
+
+static esp_err_t cache_list_handler(httpd_req_t *req) {
+    image_cache_entry_t list[IMAGE_CACHE_MAX_SLOTS];
+    size_t count = image_cache_list(list, IMAGE_CACHE_MAX_SLOTS);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, "[");
+    for (size_t i = 0; i < count; i++) {
+        char item[192];
+        if (i) httpd_resp_sendstr_chunk(req, ", ");
+        cache_entry_to_json(item, sizeof(item), &list[i]);
+        httpd_resp_sendstr_chunk(req, item);
+    }
+    httpd_resp_sendstr_chunk(req, "]");
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+
+// GET /api/cache/{sha256} - lets a client skip the upload if the image is already here
+static esp_err_t cache_lookup_handler(httpd_req_t *req) {
+    char hash_hex[IMAGE_HASH_LEN * 2 + 1];
+    uint8_t hash[IMAGE_HASH_LEN];
+    image_cache_entry_t entry;
+
+    uri_last_segment(req, hash_hex, sizeof(hash_hex));
+    if (!image_hash_from_hex(hash_hex, hash) || image_cache_lookup(hash, &entry) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Image Not Cached");
+        return ESP_FAIL;
+    }
+
+    char resp[192];
+    cache_entry_to_json(resp, sizeof(resp), &entry);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+// 7. CAN CAPTURE HANDLERS
+// POST /api/capture?ids=067B84,1F0  (hex IDs, optional)
+static esp_err_t capture_start_handler(httpd_req_t *req) {
+    uint32_t ids[CAPTURE_MAX_FILTERS];
+    size_t id_count = 0;
+    char query[128];
+    char ids_str[96];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "ids", ids_str, sizeof(ids_str)) == ESP_OK) {
+        char *p = ids_str;
+        while (*p && id_count < CAPTURE_MAX_FILTERS) {
+            ids[id_count++] = strtoul(p, &p, 16);
+            if (*p == ',') p++;
+            else break;
+        }
+    }
+
+    esp_err_t err = can_capture_start(ids, id_count);
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, err == ESP_ERR_INVALID_STATE ? "Capture Running" : "Capture Failed");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\": \"capturing\"}", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+static esp_err_t capture_stop_handler(httpd_req_t *req) {
+    can_capture_stop();
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, "{\"status\": \"stopped\"}", HTTPD_RESP_USE_STRLEN);
+    return ESP_OK;
+}
+
+// GET /api/capture?duration=<s>
+// Streams buffered frames in candump -L format. With a duration the response
+// stays open and keeps streaming new frames until it expires.
+static esp_err_t capture_get_handler(httpd_req_t *req) {
+    int duration_s = 0;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "duration", value, sizeof(value)) == ESP_OK) {
+        duration_s = atoi(value);
+        if (duration_s > CAPTURE_MAX_STREAM_S) duration_s = CAPTURE_MAX_STREAM_S;
+    }
+
+    char *chunk = malloc(CAPTURE_CHUNK_LEN);
+    if (!chunk) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "text/plain");
+    int64_t end_us = esp_timer_get_time() + (int64_t)duration_s * 1000000;
+    capture_frame_t frame;
+    esp_err_t err = ESP_OK;
+    int n;
+    do {
+        n = 0;
+        // Leave room for the longest candump line (~50 chars)
+        while (n < CAPTURE_CHUNK_LEN - 64 && can_capture_pop(&frame)) {
+            n += can_capture_format(&frame, chunk + n, CAPTURE_CHUNK_LEN - n);
+        }
+        if (n > 0) err = httpd_resp_send_chunk(req, chunk, n);
+        else if (duration_s) vTaskDelay(pdMS_TO_TICKS(20));
+    } while (err == ESP_OK && (n > 0 || esp_timer_get_time() < end_us));
+    free(chunk);
+
+    if (err != ESP_OK) return ESP_FAIL;
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// 8. ISO-TP BENCHMARK HANDLER
+// POST /api/isotp/bench?transport=sim|loopback|twai&bs=<block size>&stmin=<raw STmin byte>
+// Streams the uploaded image as ISO-TP segments and reports throughput next to
+// the last legacy transfer. Runs on an async worker until the stream ends.
+// Call with staging_lock held
+static esp_err_t run_bench(httpd_req_t *req) {
+    promote_staged();
+    if (!firmware_buffer || firmware_len == 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No Data");
+        return ESP_FAIL;
+    }
+
+    can_transport_kind_t kind = CAN_TRANSPORT_SIM;
+    uint8_t block_size = 8;
+    uint8_t st_min = 0;
+    char query[96];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "transport", value, sizeof(value)) == ESP_OK && !can_transport_from_name(value, &kind)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown Transport");
+            return ESP_FAIL;
+        }
+        if (httpd_query_key_value(query, "bs", value, sizeof(value)) == ESP_OK) block_size = strtoul(value, NULL, 0);
+        if (httpd_query_key_value(query, "stmin", value, sizeof(value)) == ESP_OK) st_min = strtoul(value, NULL, 0);
+    }
+
+    // Read before the run: the legacy figures are from the last real transfer
+    ota_status_t last;
+    ota_status_read(&last);
+
+    if (!ota_claim_bus()) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Already running");
+        return ESP_FAIL;
+    }
+    isotp_bench_t bench;
+    esp_err_t err = run_isotp_bench(firmware_buffer, firmware_len, kind, block_size, st_min, &bench);
+    ota_release_bus();
+
+    // Legacy: BURST_FRAMES data frames of FRAME_PAYLOAD bytes plus a request and a complete per burst
+    uint32_t legacy_frames_per_kb = 1024 * (BURST_FRAMES + 2) / (BURST_FRAMES * FRAME_PAYLOAD);
+    uint32_t isotp_frames_per_kb = bench.bytes ? (uint64_t)(bench.frames + bench.fc_frames) * 1024 / bench.bytes : 0;
+
+    char resp[384];
+    snprintf(resp, sizeof(resp), "{\"ok\": %s, \"transport\": \"%s\", \"bytes\": %ld, \"received\": %ld, \"segments\": %ld, "
+             "\"frames\": %ld, \"fc_frames\": %ld, \"fc_waits\": %ld, \"elapsed_us\": %ld, \"goodput_bps\": %ld, \"frames_per_kb\": %ld, "
+             "\"legacy\": {\"goodput_bps\": %ld, \"transport\": \"%s\", \"frames_per_kb\": %ld}}",
+             err == ESP_OK ? "true" : "false", can_transport_name(kind), bench.bytes, bench.received, bench.segments,
+             bench.frames, bench.fc_frames, bench.fc_waits, bench.elapsed_us, bench.goodput_bps, isotp_frames_per_kb,
+             last.goodput_bps, can_transport_name(last.transport), legacy_frames_per_kb);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+static esp_err_t isotp_bench_handler(httpd_req_t *req) {
+    if (xSemaphoreTake(staging_lock, 0) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload In Progress");
+        return ESP_FAIL;
+    }
+    esp_err_t res = run_bench(req);
+    xSemaphoreGive(staging_lock);
+    return res;
+}
+
+// 9. CHUNKED UPLOAD HANDLERS
+// POST /api/upload/session?size=<bytes>&chunk=<bytes>   open a session
+// PUT  /api/upload/session?id=<id>  Content-Range: bytes <first>-<last>/<size>, raw binary body
+// GET  /api/upload/session                              received count and missing chunks
+// POST /api/upload/finalize?id=<id>&sha256=<hex>        verify and stage as the upload image
+// Chunks can be sent in any order over several connections; after a dropped
+// connection only the chunks listed as missing need to be sent again.
+
+static esp_err_t send_session_err(httpd_req_t *req, esp_err_t err) {
+    switch (err) {
+        case ESP_ERR_NOT_FOUND: httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No Such Session"); break;
+        case ESP_ERR_INVALID_ARG:
+        case ESP_ERR_INVALID_SIZE: httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad Range"); break;
+        case ESP_ERR_INVALID_STATE: httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Chunks Missing Or In Flight"); break;
+        case ESP_ERR_INVALID_CRC: httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Digest Mismatch"); break;
+        default: httpd_resp_send_500(req); break;
+    }
+    return ESP_FAIL;
+}
+
+static uint32_t query_u32(httpd_req_t *req, const char *key, uint32_t fallback) {
+    char query[192];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK) return fallback;
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) return fallback;
+    return strtoul(value, NULL, 0);
+}
+
+// Call with staging_lock held
+static esp_err_t open_upload_session(httpd_req_t *req) {
+    if (clear_staging(req) != ESP_OK) return ESP_FAIL;
+
+    uint32_t id;
+    esp_err_t err = upload_session_open(query_u32(req, "size", 0), query_u32(req, "chunk", UPLOAD_CHUNK_DEFAULT), &id);
+    if (err != ESP_OK) {
+        if (err == ESP_ERR_NO_MEM) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Image Too Large");
+            return ESP_FAIL;
+        }
+        return send_session_err(req, err);
+    }
+
+    upload_session_info_t info;
+    upload_session_get(&info);
+    char resp[96];
+    snprintf(resp, sizeof(resp), "{\"id\": %ld, \"chunk\": %ld, \"chunks\": %ld}", info.id, info.chunk_len, info.chunks);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+static esp_err_t upload_session_post_handler(httpd_req_t *req) {
+    if (xSemaphoreTake(staging_lock, 0) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload In Progress");
+        return ESP_FAIL;
+    }
+    esp_err_t res = open_upload_session(req);
+    xSemaphoreGive(staging_lock);
+    return res;
+}
+
+// Runs on an async worker, so two chunks can be received at once
+static esp_err_t upload_chunk_put_handler(httpd_req_t *req) {
+    char range[64];
+    unsigned first, last, total;
+    if (httpd_req_get_hdr_value_str(req, "Content-Range", range, sizeof(range)) != ESP_OK ||
+        sscanf(range, "bytes %u-%u/%u", &first, &last, &total) != 3 || last < first) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad Range");
+        return ESP_FAIL;
+    }
+
+    upload_session_info_t info;
+    upload_session_get(&info);
+    size_t len = last - first + 1;
+    if (total != info.size || req->content_len != len) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad Range");
+        return ESP_FAIL;
+    }
+
+    uint32_t id = query_u32(req, "id", 0);
+    uint8_t *dst;
+    esp_err_t err = upload_session_begin_chunk(id, first, len, &dst);
+    if (err != ESP_OK) return send_session_err(req, err);
+
+    size_t got = 0;
+    while (got < len) {
+        int received = httpd_req_recv(req, (char *)dst + got, len - got);
+        if (received <= 0) {
+            upload_session_end_chunk(id, first, false);
+            return ESP_FAIL;
+        }
+        got += received;
+    }
+    upload_session_end_chunk(id, first, true);
+
+    upload_session_get(&info);
+    char resp[64];
+    snprintf(resp, sizeof(resp), "{\"received\": %ld, \"chunks\": %ld}", info.received, info.chunks);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+static esp_err_t upload_session_get_handler(httpd_req_t *req) {
+    upload_session_info_t info;
+    upload_session_get(&info);
+    uint32_t missing[64];
+    size_t count = upload_session_missing(missing, 64);
+
+    char resp[768];
+    int n = snprintf(resp, sizeof(resp), "{\"id\": %ld, \"size\": %ld, \"chunk\": %ld, \"chunks\": %ld, \"received\": %ld, \"in_flight\": %ld, \"missing\": [",
+                     info.id, info.size, info.chunk_len, info.chunks, info.received, info.in_flight);
+    for (size_t i = 0; i < count; i++) {
+        n += snprintf(resp + n, sizeof(resp) - n, "%s%ld", i ? ", " : "", missing[i]);
+    }
+    snprintf(resp + n, sizeof(resp) - n, "]}");
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
+// Call with staging_lock held
+static esp_err_t finalize_upload(httpd_req_t *req) {
+    char query[128];
+    char hex[IMAGE_HASH_LEN * 2 + 1];
+    uint8_t hash[IMAGE_HASH_LEN];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "sha256", hex, sizeof(hex)) != ESP_OK || !image_hash_from_hex(hex, hash)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing sha256");
+        return ESP_FAIL;
+    }
+
+    uint8_t *image;
+    size_t len;
+    esp_err_t err = upload_session_finish(query_u32(req, "id", 0), hash, &image, &len);
+    if (err != ESP_OK) return send_session_err(req, err);
+
+    ESP_LOGI(TAG, "Staged %d bytes from chunked upload", len);
+
+    char extra[IMAGE_HASH_LEN * 2 + 16];
+    snprintf(extra, sizeof(extra), "\"sha256\": \"%s\", ", hex);
+    send_staged(req, image, len, extra);
+    return ESP_OK;
+}
+
+static esp_err_t upload_finalize_post_handler(httpd_req_t *req) {
+    if (xSemaphoreTake(staging_lock, 0) != pdTRUE) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Upload In Progress");
+        return ESP_FAIL;
+    }
+    esp_err_t res = finalize_upload(req);
+    xSemaphoreGive(staging_lock);
+    return res;
+}
+
+// 10. TRANSFER PLANNER
+// What protocol=sparse would save on the staged image: "null" if there is
+// none or an upload is replacing it
+static void sparse_to_json(char *buf, size_t len) {
+    snprintf(buf, len, "null");
+    if (xSemaphoreTake(staging_lock, 0) != pdTRUE) return;
+    promote_staged();
+    if (!firmware_buffer || firmware_len == 0) {
+        xSemaphoreGive(staging_lock);
+        return;
+    }
+
+    size_t count = sparse_find_runs(firmware_buffer, firmware_len, CONFIG_BMS_SPARSE_PAGE_SIZE, NULL, 0);
+    fill_run_t *runs = count ? malloc(count * sizeof(fill_run_t)) : NULL;
+    if (count == 0 || runs) {
+        sparse_find_runs(firmware_buffer, firmware_len, CONFIG_BMS_SPARSE_PAGE_SIZE, runs, count);
+        uint32_t fill_bytes = 0;
+        for (size_t i = 0; i < count; i++) fill_bytes += runs[i].len;
+        uint32_t frames = sparse_count_frames(firmware_len, NULL, 0, BURST_FRAMES);
+        uint32_t sparse_frames = sparse_count_frames(firmware_len, runs, count, BURST_FRAMES);
+        snprintf(buf, len, "{\"page\": %d, \"runs\": %d, \"fill_bytes\": %ld, \"frames\": %ld, \"sparse_frames\": %ld, \"eliminated_pct\": %.1f}",
+                 CONFIG_BMS_SPARSE_PAGE_SIZE, count, fill_bytes, frames, sparse_frames,
+                 frames ? 100.0f * (frames - sparse_frames) / frames : 0.0f);
+    }
+    free(runs);
+    xSemaphoreGive(staging_lock);
+}
+
+// GET /api/plan?size=<bytes>&transport=<t>&bitrate=<bit/s>&burst=<frames>&page_ms=<ms>&page_bytes=<bytes>&turnaround_us=<us>&framing=legacy|full
+// Dry run: predicts a legacy transfer from the timing model, nothing is sent.
+// size defaults to the uploaded image. BMS timings come from past sessions on
+// that transport unless overridden, so a different BMS model can be planned.
+static esp_err_t plan_get_handler(httpd_req_t *req) {
+    can_transport_kind_t kind = CAN_TRANSPORT_TWAI;
+    char query[192];
+    char value[16];
+    bool have_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    if (have_query && httpd_query_key_value(query, "transport", value, sizeof(value)) == ESP_OK && !can_transport_from_name(value, &kind)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown Transport");
+        return ESP_FAIL;
+    }
+
+    // First, so that an upload waiting in the next slot is promoted before its size is read
+    char sparse[160];
+    sparse_to_json(sparse, sizeof(sparse));
+
+    plan_params_t p;
+    transfer_plan_params(kind, firmware_len, &p);
+    p.image_len = query_u32(req, "size", p.image_len);
+    p.bitrate = query_u32(req, "bitrate", p.bitrate);
+    p.burst_frames = query_u32(req, "burst", p.burst_frames);
+    p.bms.page_write_ms = query_u32(req, "page_ms", p.bms.page_write_ms);
+    p.bms.page_bytes = query_u32(req, "page_bytes", p.bms.page_bytes);
+    p.bms.turnaround_us = query_u32(req, "turnaround_us", p.bms.turnaround_us);
+    if (have_query && httpd_query_key_value(query, "framing", value, sizeof(value)) == ESP_OK) {
+        if (strcmp(value, "full") == 0) p.framing = DATA_FRAMING_FULL;
+        else if (strcmp(value, "legacy") == 0) p.framing = DATA_FRAMING_LEGACY;
+        else {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown Framing");
+            return ESP_FAIL;
+        }
+    }
+    if (p.image_len == 0 || p.bitrate == 0 || p.burst_frames == 0 ||
+        (p.framing == DATA_FRAMING_FULL && p.burst_frames > MAX_BURST_FRAMES)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Need size, bitrate and burst");
+        return ESP_FAIL;
+    }
+
+    plan_estimate_t est;
+    transfer_plan_estimate(&p, &est);
+
+    char resp[832];
+    snprintf(resp, sizeof(resp), "{\"size\": %ld, \"transport\": \"%s\", \"bitrate\": %ld, \"burst\": %ld, \"framing\": \"%s\", \"calibrated_sessions\": %ld, "
+             "\"bms\": {\"handshake_ms\": %ld, \"turnaround_us\": %ld, \"page_bytes\": %ld, \"page_write_ms\": %ld, \"retx_permille\": %ld}, "
+             "\"frame_us\": %ld, \"frame_worst_us\": %ld, \"bursts\": %ld, \"handshake_ms\": %ld, \"airtime_ms\": %ld, \"airtime_worst_ms\": %ld, "
+             "\"turnaround_ms\": %ld, \"flash_ms\": %ld, \"retx_ms\": %ld, \"verify_ms\": %ld, \"total_ms\": %ld, \"total_worst_ms\": %ld, \"sparse\": %s}",
+             p.image_len, can_transport_name(kind), p.bitrate, p.burst_frames,
+             p.framing == DATA_FRAMING_FULL ? "full" : "legacy", p.bms.sessions,
+             p.bms.handshake_ms, p.bms.turnaround_us, p.bms.page_bytes, p.bms.page_write_ms, p.bms.retx_permille,
+             est.frame_us, est.frame_worst_us, est.bursts, est.handshake_ms, est.airtime_ms, est.airtime_worst_ms,
+             est.turnaround_ms, est.flash_ms, est.retx_ms, est.verify_ms, est.total_ms, est.total_worst_ms, sparse);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, resp, strlen(resp));
+    return ESP_OK;
+}
+
 httpd_handle_t start_webserver(void) {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.stack_size = 8192;
+    config.task_priority = HTTPD_TASK_PRIORITY;
+    config.core_id = HTTPD_TASK_CORE;
+    config.max_uri_handlers = 24;
+    config.uri_match_fn = httpd_uri_match_wildcard;
     httpd_handle_t server = NULL;
 
+    if (start_async_workers() != ESP_OK) {
+        ESP_LOGE(TAG, "Async workers failed to start");
+        return NULL;
+    }
+
     if (httpd_start(&server, &config) == ESP_OK) {
         httpd_uri_t uri_root = { .uri = "/", .method = HTTP_GET, .handler = root_get_handler, .user_ctx = NULL };
         httpd_register_uri_handler(server, &uri_root);
 
-        httpd_uri_t uri_upload = { .uri = "/api/upload", .method = HTTP_POST, .handler = upload_post_handler, .user_ctx = NULL };
+        httpd_uri_t uri_upload = { .uri = "/api/upload", .method = HTTP_POST, .handler = async_dispatch, .user_ctx = (void *)upload_post_handler };
         httpd_register_uri_handler(server, &uri_upload);
 
         httpd_uri_t uri_flash = { .uri = "/api/flash", .method = HTTP_POST, .handler = flash_post_handler, .user_ctx = NULL };
@@ -194,6 +1117,51 @@ httpd_handle_t start_webserver(void) {
 
         httpd_uri_t uri_status = { .uri = "/api/status", .method = HTTP_GET, .handler = status_get_handler, .user_ctx = NULL };
         httpd_register_uri_handler(server, &uri_status);
+
+        httpd_uri_t uri_metrics = { .uri = "/api/metrics", .method = HTTP_GET, .handler = metrics_get_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_metrics);
+
+        httpd_uri_t uri_jobs_post = { .uri = "/api/jobs", .method = HTTP_POST, .handler = async_dispatch, .user_ctx = (void *)jobs_post_handler };
+        httpd_register_uri_handler(server, &uri_jobs_post);
+
+        httpd_uri_t uri_jobs_get = { .uri = "/api/jobs", .method = HTTP_GET, .handler = jobs_get_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_jobs_get);
+
+        httpd_uri_t uri_jobs_delete = { .uri = "/api/jobs/*", .method = HTTP_DELETE, .handler = jobs_delete_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_jobs_delete);
+
+        httpd_uri_t uri_cache_list = { .uri = "/api/cache", .method = HTTP_GET, .handler = cache_list_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_cache_list);
+
+        httpd_uri_t uri_cache_lookup = { .uri = "/api/cache/*", .method = HTTP_GET, .handler = cache_lookup_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_cache_lookup);
+
+        httpd_uri_t uri_capture_start = { .uri = "/api/capture", .method = HTTP_POST, .handler = capture_start_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_capture_start);
+
+        httpd_uri_t uri_capture_stop = { .uri = "/api/capture", .method = HTTP_DELETE, .handler = capture_stop_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_capture_stop);
+
+        httpd_uri_t uri_capture_get = { .uri = "/api/capture", .method = HTTP_GET, .handler = async_dispatch, .user_ctx = (void *)capture_get_handler };
+        httpd_register_uri_handler(server, &uri_capture_get);
+
+        httpd_uri_t uri_isotp_bench = { .uri = "/api/isotp/bench", .method = HTTP_POST, .handler = async_dispatch, .user_ctx = (void *)isotp_bench_handler };
+        httpd_register_uri_handler(server, &uri_isotp_bench);
+
+        httpd_uri_t uri_session_open = { .uri = "/api/upload/session", .method = HTTP_POST, .handler = upload_session_post_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_session_open);
+
+        httpd_uri_t uri_session_chunk = { .uri = "/api/upload/session", .method = HTTP_PUT, .handler = async_dispatch, .user_ctx = (void *)upload_chunk_put_handler };
+        httpd_register_uri_handler(server, &uri_session_chunk);
+
+        httpd_uri_t uri_session_get = { .uri = "/api/upload/session", .method = HTTP_GET, .handler = upload_session_get_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_session_get);
+
+        httpd_uri_t uri_session_finalize = { .uri = "/api/upload/finalize", .method = HTTP_POST, .handler = upload_finalize_post_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_session_finalize);
+
+        httpd_uri_t uri_plan = { .uri = "/api/plan", .method = HTTP_GET, .handler = plan_get_handler, .user_ctx = NULL };
+        httpd_register_uri_handler(server, &uri_plan);
     }
     return server;
 }
\ No newline at end of file
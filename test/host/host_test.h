@@ -0,0 +1,30 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdio.h>
+
+// Minimal assertions for the host tests: count failures, keep going
+
+static int test_failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            test_failures++;                                                \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                      \
+    do {                                                                    \
+        long long _a = (long long)(a), _b = (long long)(b);                 \
+        if (_a != _b) {                                                     \
+            fprintf(stderr, "%s:%d: %s == %lld, expected %lld\n", __FILE__, __LINE__, #a, _a, _b); \
+            test_failures++;                                                \
+        }                                                                   \
+    } while (0)
+
+#define TEST_RESULT(name)                                                   \
+    (printf("%s: %s\n", name, test_failures ? "FAILED" : "OK"), test_failures ? 1 : 0)
+
+#endif // HOST_TEST_H
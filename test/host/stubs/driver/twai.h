@@ -0,0 +1,24 @@
+#ifndef TWAI_H
+#define TWAI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct {
+    uint32_t extd : 1;
+    uint32_t rtr : 1;
+    uint32_t identifier;
+    uint8_t data_length_code;
+    uint8_t data[8];
+} twai_message_t;
+
+typedef struct {
+    uint32_t tx_error_counter;
+    uint32_t rx_error_counter;
+    uint32_t rx_missed_count;
+    uint32_t rx_overrun_count;
+} twai_status_info_t;
+
+#endif // TWAI_H
@@ -0,0 +1,9 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <stdint.h>
+
+// Virtual clock (host_clock.c): every read advances it by 1 us, vTaskDelay by whole ticks
+int64_t esp_timer_get_time(void);
+
+#endif // ESP_TIMER_H
@@ -0,0 +1,16 @@
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+static int64_t now_us;
+
+int64_t esp_timer_get_time(void) {
+    return ++now_us;
+}
+
+void vTaskDelay(TickType_t ticks) {
+    now_us += (int64_t)ticks * portTICK_PERIOD_MS * 1000;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return now_us / (portTICK_PERIOD_MS * 1000);
+}
@@ -0,0 +1,10 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Kconfig defaults for what the tested modules read. Nothing else set:
+// task_config.h falls back to the default CAN profile.
+#define CONFIG_BMS_FLASH_PAGE_SIZE 256
+#define CONFIG_BMS_FLASH_WRITE_MS 4
+#define CONFIG_BMS_FLASH_ALIGN 0
+
+#endif // SDKCONFIG_H
@@ -0,0 +1,176 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "can_codec.h"
+#include "host_test.h"
+
+// Every entry of the message tables in can_protocol.h through the generated codec
+
+// --- GATEWAY COMMANDS ---
+
+#define CHECK_COMMAND(name, id, b0, b1)                                          \
+    do {                                                                         \
+        twai_message_t m;                                                        \
+        const uint8_t want[8] = { (b0), (b1) };                                  \
+        can_encode_command(name, &m);                                            \
+        CHECK_EQ(m.identifier, id);                                              \
+        CHECK(m.extd);                                                           \
+        CHECK_EQ(m.data_length_code, 8);                                         \
+        CHECK(memcmp(m.data, want, 8) == 0);                                     \
+        CHECK_EQ(can_decode_command(&m), name);                                  \
+        commands++;                                                              \
+    } while (0);
+
+static void test_commands(void) {
+    int commands = 0;
+    CAN_COMMANDS(CHECK_COMMAND)
+    CHECK_EQ(commands, CAN_COMMAND_COUNT);
+
+    twai_message_t other = { .extd = 1, .identifier = ID_HANDSHAKE, .data_length_code = 8, .data = { 0x02 } };
+    CHECK_EQ(can_decode_command(&other), CAN_COMMAND_COUNT);
+}
+
+// --- BMS RESPONSES ---
+
+static twai_message_t response(const uint8_t data[8]) {
+    twai_message_t m = { .extd = 1, .identifier = ID_BMS_RESPONSE, .data_length_code = 8 };
+    memcpy(m.data, data, 8);
+    return m;
+}
+
+// Packs `sum` into the first bytes, as a stock BMS does
+static twai_message_t sum_packed(uint16_t sum) {
+    uint8_t d[8] = { 0 };
+    for (int i = 0; i < 8 && sum; i++) {
+        d[i] = sum > 0xFF ? 0xFF : sum;
+        sum -= d[i];
+    }
+    return response(d);
+}
+
+// Spreads `sum` over all 8 bytes; only the sum may matter to the decoder
+static twai_message_t sum_spread(uint16_t sum) {
+    uint8_t d[8];
+    for (int i = 0; i < 8; i++) d[i] = sum / 8 + (i < sum % 8);
+    return response(d);
+}
+
+#define CHECK_MARKER(name, key)                                                  \
+    do {                                                                         \
+        twai_message_t m = response((const uint8_t[8]){ (key), 0x01, 0x02, 0x03, 0x04 }); \
+        CHECK_EQ(can_decode_response(&m), name);                                 \
+        markers++;                                                               \
+    } while (0);
+
+#define CHECK_SUM(name, key)                                                     \
+    do {                                                                         \
+        twai_message_t m = sum_packed(key);                                      \
+        CHECK_EQ(can_decode_response(&m), name);                                 \
+        m = sum_spread(key);                                                     \
+        CHECK_EQ(can_decode_response(&m), name);                                 \
+        sums++;                                                                  \
+    } while (0);
+
+static void test_responses(void) {
+    int markers = 0, sums = 0;
+    BMS_RESPONSES(CHECK_MARKER, CHECK_SUM)
+    CHECK_EQ(markers, 3);
+    CHECK_EQ(sums, 9);
+}
+
+// Keys that share a kind, and the 9-bit sum, in the shape a legacy BMS sends them
+static void test_legacy_sums(void) {
+    twai_message_t m;
+    m = response((const uint8_t[8]){ 0x18 });
+    CHECK_EQ(can_decode_response(&m), BMS_FLASH_BUSY);
+    m = response((const uint8_t[8]){ 0x18, 0x18 });
+    CHECK_EQ(can_decode_response(&m), BMS_FLASH_BUSY);
+    m = response((const uint8_t[8]){ 0x30 });
+    CHECK_EQ(can_decode_response(&m), BMS_FLASH_BUSY);
+    m = response((const uint8_t[8]){ 0xFF, 0x23 });
+    CHECK_EQ(can_decode_response(&m), BMS_START);
+    m = response((const uint8_t[8]){ 0x91, 0x91 });
+    CHECK_EQ(can_decode_response(&m), BMS_START);
+}
+
+static void test_not_responses(void) {
+    twai_message_t m = response((const uint8_t[8]){ 0 });
+    CHECK_EQ(can_decode_response(&m), BMS_NONE);
+    m = sum_packed(40);
+    CHECK_EQ(can_decode_response(&m), BMS_NONE);
+    m = sum_packed(BMS_RESPONSE_MAX_SUM);
+    CHECK_EQ(can_decode_response(&m), BMS_NONE);
+    // Right payload, wrong ID
+    m = sum_packed(0x88);
+    m.identifier = ID_SIZE;
+    CHECK_EQ(can_decode_response(&m), BMS_NONE);
+}
+
+// The simulated BMS answers with can_encode_response(); every kind must decode to itself
+static void test_response_round_trip(void) {
+    for (int kind = BMS_NONE + 1; kind < BMS_RESPONSE_COUNT; kind++) {
+        twai_message_t m;
+        can_encode_response(kind, &m);
+        CHECK_EQ(m.identifier, ID_BMS_RESPONSE);
+        CHECK_EQ(can_decode_response(&m), kind);
+    }
+    // First key wins for kinds with several
+    twai_message_t m;
+    can_encode_response(BMS_FLASH_BUSY, &m);
+    CHECK_EQ(m.data[0], 24);
+}
+
+// --- FRAMES WITH FIELDS ---
+
+static void test_size_frame(void) {
+    twai_message_t m;
+    const uint8_t legacy[8] = { 0x34, 0x12 };
+    can_encode_size(0x1234, DATA_ENCODING_RAW, 0x1234, DATA_FRAMING_LEGACY, 0, &m);
+    CHECK_EQ(m.identifier, ID_SIZE);
+    CHECK(memcmp(m.data, legacy, 8) == 0);
+
+    const uint8_t full[8] = { 0x00, 0x80, DATA_ENCODING_LZSS, 0x56, 0x34, 0x01, DATA_FRAMING_FULL, 8 };
+    can_encode_size(0x8000, DATA_ENCODING_LZSS, 0x13456, DATA_FRAMING_FULL, 8, &m);
+    CHECK(memcmp(m.data, full, 8) == 0);
+}
+
+static void test_fill_frame(void) {
+    twai_message_t m;
+    uint32_t offset, len;
+    uint8_t value;
+    can_encode_fill(0x012345, 0x000400, 0xFF, &m);
+    CHECK_EQ(m.identifier, ID_FILL);
+    CHECK(can_decode_fill(&m, &offset, &len, &value));
+    CHECK_EQ(offset, 0x012345);
+    CHECK_EQ(len, 0x400);
+    CHECK_EQ(value, 0xFF);
+    m.data[3] ^= 1;
+    CHECK(!can_decode_fill(&m, &offset, &len, &value));
+}
+
+static void test_data_frame(void) {
+    twai_message_t m;
+    const uint8_t payload[4] = { 1, 2, 3, 4 };
+    can_encode_data(payload, sizeof(payload), &m);
+    CHECK_EQ(m.identifier, ID_DATA);
+    CHECK_EQ(m.data[4], 0xFF);
+    CHECK_EQ(m.data[5], 0xFF);
+    uint16_t crc = calcrc(m.data, FRAME_PAYLOAD);
+    CHECK_EQ(m.data[6], crc & 0xFF);
+    CHECK_EQ(m.data[7], crc >> 8);
+    // CRC-16/XMODEM check value
+    CHECK_EQ(calcrc((uint8_t *)"123456789", 9), 0x31C3);
+}
+
+int main(void) {
+    test_commands();
+    test_responses();
+    test_legacy_sums();
+    test_not_responses();
+    test_response_round_trip();
+    test_size_frame();
+    test_fill_frame();
+    test_data_frame();
+    return TEST_RESULT("codec");
+}
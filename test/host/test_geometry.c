@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "flash_geometry.h"
+#include "host_test.h"
+
+// Page blocks for page-aligned bursts, for the full frame size
+
+#define FRAME 8
+#define MAX_ENDS 64
+
+static uint32_t ends[MAX_ENDS];
+
+static void test_config_defaults(void) {
+    flash_geometry_t g;
+    flash_geometry_config(&g);
+    CHECK_EQ(g.page_bytes, 256);
+    CHECK_EQ(g.write_ms, 4);
+    CHECK_EQ(g.align, 0);
+}
+
+static void test_page_start(void) {
+    flash_geometry_t g = { 256, 4, 0 };
+    size_t count = flash_split_pages(&g, FRAME, 1000, ends, MAX_ENDS);
+    CHECK_EQ(count, 4);
+    CHECK_EQ(ends[0], 256);
+    CHECK_EQ(ends[1], 512);
+    CHECK_EQ(ends[2], 768);
+    CHECK_EQ(ends[3], 1000);
+    CHECK_EQ(flash_split_pages(&g, FRAME, 1000, NULL, 0), count);
+    CHECK_EQ(flash_split_pages(&g, FRAME, 512, ends, MAX_ENDS), 2);
+    CHECK_EQ(ends[1], 512);
+}
+
+// Image starts 96 bytes into its page: a short first block, then whole pages
+static void test_nonzero_align(void) {
+    flash_geometry_t g = { 256, 4, 96 };
+    CHECK(flash_pages_frame_aligned(&g, FRAME));
+    size_t count = flash_split_pages(&g, FRAME, 1000, ends, MAX_ENDS);
+    CHECK_EQ(count, 5);
+    CHECK_EQ(ends[0], 160);
+    CHECK_EQ(ends[1], 416);
+    CHECK_EQ(ends[3], 928);
+    CHECK_EQ(ends[4], 1000);
+    for (size_t i = 0; i + 1 < count; i++) {
+        CHECK_EQ(ends[i] % FRAME, 0);
+        CHECK_EQ((ends[i] + g.align) % g.page_bytes, 0);
+    }
+
+    // Larger than one page: same as the remainder
+    flash_geometry_t wrapped = { 256, 4, 256 + 96 };
+    CHECK_EQ(flash_split_pages(&wrapped, FRAME, 1000, ends, MAX_ENDS), 5);
+    CHECK_EQ(ends[0], 160);
+}
+
+// Boundaries inside a frame can't be hit by a burst: no blocks at all
+static void test_unaligned_boundaries(void) {
+    flash_geometry_t offset = { 256, 4, 100 };
+    CHECK(!flash_pages_frame_aligned(&offset, FRAME));
+    CHECK_EQ(flash_split_pages(&offset, FRAME, 1000, ends, MAX_ENDS), 0);
+    // Legacy 6-byte frames never divide these pages either
+    flash_geometry_t page = { 256, 4, 0 };
+    CHECK_EQ(flash_split_pages(&page, 6, 1000, ends, MAX_ENDS), 0);
+    flash_geometry_t odd_page = { 100, 4, 0 };
+    CHECK_EQ(flash_split_pages(&odd_page, FRAME, 1000, ends, MAX_ENDS), 0);
+    flash_geometry_t unknown = { 0, 4, 0 };
+    CHECK_EQ(flash_split_pages(&unknown, FRAME, 1000, ends, MAX_ENDS), 0);
+    CHECK_EQ(flash_split_pages(&page, FRAME, 0, ends, MAX_ENDS), 0);
+}
+
+static void test_truncated_output(void) {
+    flash_geometry_t g = { 256, 4, 96 };
+    memset(ends, 0, sizeof(ends));
+    CHECK_EQ(flash_split_pages(&g, FRAME, 1000, ends, 2), 5);
+    CHECK_EQ(ends[1], 416);
+    CHECK_EQ(ends[2], 0);
+}
+
+static void test_block_end(void) {
+    flash_geometry_t g = { 256, 4, 96 };
+    size_t count = flash_split_pages(&g, FRAME, 1000, ends, MAX_ENDS);
+    CHECK_EQ(flash_block_end(ends, count, 0, 1000), 160);
+    CHECK_EQ(flash_block_end(ends, count, 152, 1000), 160);
+    // A block end starts the next block
+    CHECK_EQ(flash_block_end(ends, count, 160, 1000), 416);
+    CHECK_EQ(flash_block_end(ends, count, 415, 1000), 416);
+    CHECK_EQ(flash_block_end(ends, count, 928, 1000), 1000);
+    CHECK_EQ(flash_block_end(ends, count, 1000, 1000), 1000);
+    CHECK_EQ(flash_block_end(ends, 0, 500, 1000), 1000);
+
+    // Bursts of 16 full frames stepping through the image stop exactly on every block end
+    size_t hit = 0;
+    for (uint32_t offset = 0; offset < 1000;) {
+        uint32_t end = flash_block_end(ends, count, offset, 1000);
+        for (int i = 0; i < 16 && offset < end; i++) offset += FRAME;
+        if (offset == end) hit++;
+        CHECK(offset <= end || end == 1000);
+    }
+    CHECK_EQ(hit, count);
+}
+
+int main(void) {
+    test_config_defaults();
+    test_page_start();
+    test_nonzero_align();
+    test_unaligned_boundaries();
+    test_truncated_output();
+    test_block_end();
+    return TEST_RESULT("geometry");
+}
@@ -0,0 +1,402 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "isotp.h"
+#include "host_test.h"
+
+// ISO-TP segmentation against a simulated peer behind the transport
+
+#define GW_ID 0x7E0
+#define PEER_ID 0x7E8
+#define QUEUE_LEN 64
+#define MAX_MSG 8192
+
+#define FC_CTS 0
+#define FC_WAIT 1
+#define FC_OVFLW 2
+
+// --- SIMULATED PEER ---
+// Frames the gateway sends are handled at once; answers wait in a queue for
+// the gateway's next recv(). As a sender, the peer emits consecutive frames
+// lazily, as many as the gateway's last flow control allows.
+
+typedef enum { PEER_RECEIVER, PEER_SENDER } peer_role_t;
+
+static struct {
+    peer_role_t role;
+
+    // Flow control the receiver answers every first frame and block with
+    uint8_t block_size;
+    uint8_t st_min;
+    uint8_t waits;  // FC.WAIT frames before each CTS
+    uint8_t status; // FC_CTS or FC_OVFLW
+    bool silent;    // Never answers
+
+    uint8_t data[MAX_MSG];
+    size_t len;
+    size_t pos;
+    uint8_t sn;
+    bool sn_error;
+    bool escape; // First frame used the 32-bit length
+    int in_block;
+    uint32_t consecutive;
+    uint32_t flow_controls; // Sent as receiver, received as sender
+    int64_t last_cf_us;
+    int64_t min_gap_us; // Smallest gap between consecutive frames of one block
+
+    // Sender side
+    uint32_t credit;  // Consecutive frames the gateway's flow control allows
+    uint8_t last_fc;  // PCI byte of the gateway's last flow control
+    uint32_t bad_sn_at; // 1-based CF index sent with a wrong sequence number, 0 = never
+
+    twai_message_t queue[QUEUE_LEN];
+    int head;
+    int tail;
+} peer;
+
+static void peer_reset(peer_role_t role) {
+    memset(&peer, 0, sizeof(peer));
+    peer.role = role;
+    peer.min_gap_us = INT64_MAX;
+}
+
+static void push(const uint8_t *d, size_t n) {
+    twai_message_t m = { .identifier = PEER_ID, .data_length_code = 8 };
+    memset(m.data, ISOTP_PADDING, 8);
+    memcpy(m.data, d, n);
+    peer.queue[peer.head++ % QUEUE_LEN] = m;
+}
+
+static void queue_flow_control(void) {
+    for (int i = 0; i < peer.waits; i++) push((const uint8_t[]){ 0x30 | FC_WAIT, 0, 0 }, 3);
+    push((const uint8_t[]){ 0x30 | peer.status, peer.block_size, peer.st_min }, 3);
+    peer.flow_controls++;
+}
+
+static void receiver_frame(const uint8_t *d) {
+    switch (d[0] >> 4) {
+        case 0:
+            peer.len = d[0] & 0x0F;
+            memcpy(peer.data, d + 1, peer.len);
+            peer.pos = peer.len;
+            break;
+        case 1:
+            peer.len = ((d[0] & 0x0F) << 8) | d[1];
+            peer.escape = peer.len == 0;
+            if (peer.escape) {
+                peer.len = ((uint32_t)d[2] << 24) | (d[3] << 16) | (d[4] << 8) | d[5];
+                memcpy(peer.data, d + 6, 2);
+                peer.pos = 2;
+            } else {
+                memcpy(peer.data, d + 2, 6);
+                peer.pos = 6;
+            }
+            peer.sn = 1;
+            if (!peer.silent) queue_flow_control();
+            break;
+        case 2: {
+            if ((d[0] & 0x0F) != peer.sn) peer.sn_error = true;
+            peer.sn = (peer.sn + 1) & 0x0F;
+
+            // The first frame of a block may follow the flow control at once
+            int64_t now = esp_timer_get_time();
+            if (peer.in_block > 0 && now - peer.last_cf_us < peer.min_gap_us) peer.min_gap_us = now - peer.last_cf_us;
+            peer.last_cf_us = now;
+
+            size_t chunk = peer.len - peer.pos > 7 ? 7 : peer.len - peer.pos;
+            memcpy(peer.data + peer.pos, d + 1, chunk);
+            peer.pos += chunk;
+            peer.consecutive++;
+            peer.in_block++;
+            if (peer.block_size && peer.in_block == peer.block_size && peer.pos < peer.len) {
+                peer.in_block = 0;
+                queue_flow_control();
+            }
+            break;
+        }
+    }
+}
+
+static void sender_frame(const uint8_t *d) {
+    if ((d[0] & 0xF0) != 0x30) return;
+    peer.last_fc = d[0];
+    peer.flow_controls++;
+    if ((d[0] & 0x0F) == FC_CTS) peer.credit = d[1] ? d[1] : UINT32_MAX;
+}
+
+static esp_err_t peer_send(const twai_message_t *msg, TickType_t timeout) {
+    if (msg->identifier != GW_ID) return ESP_FAIL;
+    if (peer.role == PEER_RECEIVER) receiver_frame(msg->data);
+    else sender_frame(msg->data);
+    return ESP_OK;
+}
+
+static esp_err_t peer_recv(twai_message_t *msg, TickType_t timeout) {
+    if (peer.tail != peer.head) {
+        *msg = peer.queue[peer.tail++ % QUEUE_LEN];
+        return ESP_OK;
+    }
+    if (peer.role == PEER_SENDER && peer.credit && peer.pos < peer.len) {
+        uint8_t cf[8];
+        size_t chunk = peer.len - peer.pos > 7 ? 7 : peer.len - peer.pos;
+        peer.consecutive++;
+        cf[0] = 0x20 | (peer.consecutive == peer.bad_sn_at ? (peer.sn + 1) & 0x0F : peer.sn);
+        memcpy(cf + 1, peer.data + peer.pos, chunk);
+        push(cf, chunk + 1);
+        peer.pos += chunk;
+        peer.sn = (peer.sn + 1) & 0x0F;
+        peer.credit--;
+        *msg = peer.queue[peer.tail++ % QUEUE_LEN];
+        return ESP_OK;
+    }
+    vTaskDelay(timeout);
+    return ESP_ERR_TIMEOUT;
+}
+
+static const can_transport_t peer_transport = {
+    .name = "peer",
+    .send = peer_send,
+    .recv = peer_recv,
+};
+
+// Queues the first frame of `len` bytes of `data`; the rest follows the gateway's flow control
+static void peer_start_message(const uint8_t *data, size_t len) {
+    uint8_t ff[8];
+    memcpy(peer.data, data, len);
+    peer.len = len;
+    peer.sn = 1;
+    if (len <= 7) {
+        ff[0] = len;
+        memcpy(ff + 1, data, len);
+        peer.pos = len;
+        push(ff, len + 1);
+    } else if (len <= 4095) {
+        ff[0] = 0x10 | (len >> 8);
+        ff[1] = len & 0xFF;
+        memcpy(ff + 2, data, 6);
+        peer.pos = 6;
+        push(ff, 8);
+    } else {
+        ff[0] = 0x10;
+        ff[1] = 0;
+        ff[2] = len >> 24;
+        ff[3] = (len >> 16) & 0xFF;
+        ff[4] = (len >> 8) & 0xFF;
+        ff[5] = len & 0xFF;
+        memcpy(ff + 6, data, 2);
+        peer.pos = 2;
+        push(ff, 8);
+    }
+}
+
+// --- HELPERS ---
+
+static uint8_t message[MAX_MSG];
+static uint8_t received[MAX_MSG];
+
+static void fill_message(size_t len) {
+    for (size_t i = 0; i < len; i++) message[i] = (uint8_t)(i * 7 + (i >> 8));
+}
+
+static uint32_t consecutive_frames(size_t len, size_t first) {
+    return (len - first + 6) / 7;
+}
+
+static esp_err_t gateway_send(size_t len, isotp_link_t *link) {
+    fill_message(len);
+    isotp_link_init(link, &peer_transport, GW_ID, PEER_ID);
+    return isotp_send(link, message, len);
+}
+
+// --- GATEWAY AS SENDER ---
+
+static void test_send_single_frame(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    CHECK_EQ(gateway_send(7, &link), ESP_OK);
+    CHECK_EQ(peer.len, 7);
+    CHECK(memcmp(peer.data, message, 7) == 0);
+    CHECK_EQ(peer.flow_controls, 0);
+}
+
+static void test_send_12bit_limit(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    CHECK_EQ(gateway_send(4095, &link), ESP_OK);
+    CHECK(!peer.escape);
+    CHECK_EQ(peer.len, 4095);
+    CHECK(memcmp(peer.data, message, 4095) == 0);
+    CHECK_EQ(peer.consecutive, consecutive_frames(4095, 6));
+}
+
+static void test_send_escape_and_sn_wrap(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    CHECK_EQ(gateway_send(5000, &link), ESP_OK);
+    CHECK(peer.escape);
+    CHECK_EQ(peer.len, 5000);
+    CHECK(memcmp(peer.data, message, 5000) == 0);
+    // 714 consecutive frames wrap the sequence number 0xF -> 0x0 many times
+    CHECK_EQ(peer.consecutive, consecutive_frames(5000, 2));
+    CHECK(!peer.sn_error);
+    CHECK_EQ(link.frames_sent, 1 + peer.consecutive);
+}
+
+static void test_send_block_size_and_st_min(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    peer.block_size = 4;
+    peer.st_min = 5;
+    CHECK_EQ(gateway_send(1000, &link), ESP_OK);
+    CHECK(memcmp(peer.data, message, 1000) == 0);
+    uint32_t cfs = consecutive_frames(1000, 6);
+    CHECK_EQ(peer.consecutive, cfs);
+    CHECK_EQ(peer.flow_controls, (cfs + 3) / 4);
+    CHECK_EQ(link.fc_received, peer.flow_controls);
+    CHECK_EQ(link.st_min_us, 5000);
+    CHECK(peer.min_gap_us >= 5000);
+}
+
+static void test_send_st_min_microseconds(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    peer.st_min = 0xF3;
+    CHECK_EQ(gateway_send(200, &link), ESP_OK);
+    CHECK(memcmp(peer.data, message, 200) == 0);
+    CHECK_EQ(link.st_min_us, 300);
+    CHECK(peer.min_gap_us >= 300);
+}
+
+static void test_send_wait(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    peer.waits = 3;
+    peer.block_size = 16;
+    CHECK_EQ(gateway_send(300, &link), ESP_OK);
+    CHECK(memcmp(peer.data, message, 300) == 0);
+    CHECK_EQ(link.fc_waits, 3 * peer.flow_controls);
+}
+
+static void test_send_too_many_waits(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    peer.waits = ISOTP_MAX_WAIT_FRAMES + 1;
+    CHECK_EQ(gateway_send(300, &link), ESP_ERR_TIMEOUT);
+    CHECK_EQ(peer.consecutive, 0);
+}
+
+static void test_send_overflow(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    peer.status = FC_OVFLW;
+    CHECK_EQ(gateway_send(300, &link), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(peer.consecutive, 0);
+}
+
+static void test_send_no_flow_control(void) {
+    isotp_link_t link;
+    peer_reset(PEER_RECEIVER);
+    peer.silent = true;
+    CHECK_EQ(gateway_send(300, &link), ESP_ERR_TIMEOUT);
+}
+
+// --- GATEWAY AS RECEIVER ---
+
+static esp_err_t gateway_receive(uint8_t block_size, uint8_t *buf, size_t size, size_t *out_len) {
+    isotp_link_t link;
+    isotp_link_init(&link, &peer_transport, GW_ID, PEER_ID);
+    link.rx_block_size = block_size;
+    return isotp_receive(&link, buf, size, out_len, pdMS_TO_TICKS(1000));
+}
+
+static void test_receive_single_frame(void) {
+    size_t len = 0;
+    peer_reset(PEER_SENDER);
+    fill_message(5);
+    peer_start_message(message, 5);
+    CHECK_EQ(gateway_receive(0, received, sizeof(received), &len), ESP_OK);
+    CHECK_EQ(len, 5);
+    CHECK(memcmp(received, message, 5) == 0);
+}
+
+static void test_receive_escape_with_blocks(void) {
+    size_t len = 0;
+    peer_reset(PEER_SENDER);
+    fill_message(5000);
+    peer_start_message(message, 5000);
+    CHECK_EQ(gateway_receive(8, received, sizeof(received), &len), ESP_OK);
+    CHECK_EQ(len, 5000);
+    CHECK(memcmp(received, message, 5000) == 0);
+    uint32_t cfs = consecutive_frames(5000, 2);
+    CHECK_EQ(peer.consecutive, cfs);
+    CHECK_EQ(peer.flow_controls, (cfs + 7) / 8);
+}
+
+static void test_receive_overflow(void) {
+    size_t len = 0;
+    peer_reset(PEER_SENDER);
+    fill_message(100);
+    peer_start_message(message, 100);
+    CHECK_EQ(gateway_receive(0, received, 50, &len), ESP_ERR_INVALID_SIZE);
+    CHECK_EQ(peer.last_fc, 0x30 | FC_OVFLW);
+}
+
+static void test_receive_bad_sequence(void) {
+    size_t len = 0;
+    peer_reset(PEER_SENDER);
+    peer.bad_sn_at = 20;
+    fill_message(500);
+    peer_start_message(message, 500);
+    CHECK_EQ(gateway_receive(0, received, sizeof(received), &len), ESP_ERR_INVALID_RESPONSE);
+}
+
+// A first frame announcing fewer bytes than it carries must not be copied
+static void test_receive_short_first_frame(void) {
+    uint8_t guard[16];
+    size_t len = 0;
+    memset(guard, 0xAA, sizeof(guard));
+    peer_reset(PEER_SENDER);
+    push((const uint8_t[]){ 0x10, 3, 1, 2, 3, 4, 5, 6 }, 8);
+    CHECK_EQ(gateway_receive(0, guard, 4, &len), ESP_ERR_INVALID_RESPONSE);
+    for (size_t i = 0; i < sizeof(guard); i++) CHECK_EQ(guard[i], 0xAA);
+    CHECK_EQ(peer.flow_controls, 0);
+
+    peer_reset(PEER_SENDER);
+    push((const uint8_t[]){ 0x10, 0, 0, 0, 0x0F, 0xFF, 1, 2 }, 8);
+    CHECK_EQ(gateway_receive(0, received, sizeof(received), &len), ESP_ERR_INVALID_RESPONSE);
+    CHECK_EQ(peer.flow_controls, 0);
+}
+
+static void test_st_min_encoding(void) {
+    CHECK_EQ(isotp_st_min_us(0x00), 0);
+    CHECK_EQ(isotp_st_min_us(0x7F), 127000);
+    CHECK_EQ(isotp_st_min_us(0xF1), 100);
+    CHECK_EQ(isotp_st_min_us(0xF9), 900);
+    CHECK_EQ(isotp_st_min_us(0x80), 127000);
+    CHECK_EQ(isotp_st_min_us(0xFA), 127000);
+}
+
+int main(void) {
+    test_send_single_frame();
+    test_send_12bit_limit();
+    test_send_escape_and_sn_wrap();
+    test_send_block_size_and_st_min();
+    test_send_st_min_microseconds();
+    test_send_wait();
+    test_send_too_many_waits();
+    test_send_overflow();
+    test_send_no_flow_control();
+
+    test_receive_single_frame();
+    test_receive_escape_with_blocks();
+    test_receive_overflow();
+    test_receive_bad_sequence();
+    test_receive_short_first_frame();
+
+    test_st_min_encoding();
+    return TEST_RESULT("isotp");
+}
@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lzss.h"
+#include "test_data.h"
+#include "host_test.h"
+
+// lzss_encode() against the reference decoder, fed the way a BMS receives it
+
+#define MAX_INPUT 32768
+
+static uint8_t input[MAX_INPUT];
+static uint8_t packed[LZSS_BOUND(MAX_INPUT)];
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+    size_t cap;
+} sink_t;
+
+static void collect(void *ctx, uint8_t byte) {
+    sink_t *s = ctx;
+    if (s->len < s->cap) s->buf[s->len] = byte;
+    s->len++;
+}
+
+// Encodes `len` bytes of `in`, then decodes the stream `split` bytes at a time
+static void round_trip(const char *name, const uint8_t *in, size_t len, size_t split) {
+    size_t packed_len = lzss_encode(in, len, packed, sizeof(packed));
+    CHECK(packed_len > 0);
+    CHECK(packed_len <= LZSS_BOUND(len));
+
+    static uint8_t out[MAX_INPUT];
+    sink_t sink = { out, 0, sizeof(out) };
+    lzss_decoder_t d;
+    lzss_decoder_init(&d);
+    size_t produced = 0;
+    for (size_t pos = 0; pos < packed_len; pos += split) {
+        size_t n = packed_len - pos < split ? packed_len - pos : split;
+        produced += lzss_decode(&d, packed + pos, n, collect, &sink);
+    }
+    CHECK_EQ(produced, len);
+    CHECK_EQ(sink.len, len);
+    if (sink.len != len || memcmp(out, in, len) != 0) {
+        fprintf(stderr, "%s: mismatch with %d-byte feeds\n", name, (int)split);
+        test_failures++;
+    }
+}
+
+static void round_trip_splits(const char *name, const uint8_t *in, size_t len) {
+    // FRAME_PAYLOAD and FRAME_PAYLOAD_FULL, one byte, and an odd split that
+    // lands between both bytes of matches
+    static const size_t splits[] = { 6, 8, 1, 5, 4096 };
+    for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); i++) round_trip(name, in, len, splits[i]);
+}
+
+static void fill_random(uint8_t *buf, size_t len, uint32_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+static void test_bms_image(void) {
+    round_trip_splits("bms image", EXPECTED_DATA, sizeof(EXPECTED_DATA));
+    // The gateway only compresses when it gains; the test image does
+    CHECK(lzss_encode(EXPECTED_DATA, sizeof(EXPECTED_DATA), packed, sizeof(EXPECTED_DATA) - 1) > 0);
+}
+
+// Erased flash: distance-1 matches that overlap their own output, at full length
+static void test_erased_run(void) {
+    memset(input, 0xFF, 4096);
+    round_trip_splits("erased", input, 4096);
+    size_t packed_len = lzss_encode(input, 4096, packed, sizeof(packed));
+    CHECK(packed_len < 4096 / LZSS_MAX_MATCH * 3 + 16);
+}
+
+// Repeats exactly LZSS_WINDOW bytes back: the longest distance
+static void test_window_edge(void) {
+    fill_random(input, LZSS_WINDOW, 7);
+    memcpy(input + LZSS_WINDOW, input, LZSS_WINDOW);
+    memcpy(input + 2 * LZSS_WINDOW, input, LZSS_WINDOW);
+    round_trip_splits("window edge", input, 3 * LZSS_WINDOW);
+}
+
+// Next to no matches: almost every group is a flag byte and 8 literals
+static void test_incompressible(void) {
+    fill_random(input, MAX_INPUT, 1);
+    round_trip_splits("random", input, MAX_INPUT);
+    CHECK(lzss_encode(input, MAX_INPUT, packed, sizeof(packed)) > MAX_INPUT);
+    CHECK_EQ(lzss_encode(input, MAX_INPUT, packed, MAX_INPUT - 1), 0);
+}
+
+// Literals and matches of every length class mixed, ending mid-group
+static void test_mixed(void) {
+    size_t len = 0;
+    uint32_t seed = 3;
+    while (len < MAX_INPUT - 600) {
+        seed = seed * 1103515245 + 12345;
+        size_t run = 1 + (seed >> 16) % 300;
+        if (seed & 0x100) {
+            size_t back = 1 + (seed >> 20) % (len < LZSS_WINDOW ? len + 1 : LZSS_WINDOW);
+            for (size_t i = 0; i < run; i++, len++) input[len] = len >= back ? input[len - back] : 0;
+        } else {
+            fill_random(input + len, run, seed);
+            len += run;
+        }
+    }
+    round_trip_splits("mixed", input, len - 3);
+    round_trip_splits("short", input, 2);
+}
+
+int main(void) {
+    test_bms_image();
+    test_erased_run();
+    test_window_edge();
+    test_incompressible();
+    test_mixed();
+    return TEST_RESULT("lzss");
+}
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Stages an image on the gateway with the resumable chunked upload API.
+
+Chunks go out over several connections at once. After a failure only the
+chunks the gateway reports as missing are sent again.
+
+    python3 tools/chunked_upload.py --host 192.168.4.1 firmware.bin
+    python3 tools/chunked_upload.py --hex firmware.txt      # hex text, as the web page takes
+"""
+import argparse
+import hashlib
+import json
+import re
+import time
+import urllib.error
+import urllib.request
+from concurrent.futures import ThreadPoolExecutor
+
+
+def request(method, url, body=None, headers=None):
+    req = urllib.request.Request(url, data=body, method=method, headers=headers or {})
+    with urllib.request.urlopen(req, timeout=30) as resp:
+        return json.loads(resp.read() or b"{}")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("image")
+    ap.add_argument("--host", default="192.168.4.1")
+    ap.add_argument("--hex", action="store_true", help="image file is hex text")
+    ap.add_argument("--chunk", type=int, default=4096)
+    ap.add_argument("--parallel", type=int, default=2, help="gateway has 2 upload workers by default")
+    ap.add_argument("--attempts", type=int, default=5)
+    args = ap.parse_args()
+
+    with open(args.image, "rb") as f:
+        data = f.read()
+    if args.hex:
+        data = bytes.fromhex(re.sub(r"0x|[^0-9A-Fa-f]", "", data.decode(), flags=re.I))
+
+    base = f"http://{args.host}/api/upload"
+    session = request("POST", f"{base}/session?size={len(data)}&chunk={args.chunk}")
+    sid, chunk = session["id"], session["chunk"]
+
+    def put(idx):
+        first = idx * chunk
+        body = data[first:first + chunk]
+        headers = {"Content-Range": f"bytes {first}-{first + len(body) - 1}/{len(data)}",
+                   "Content-Type": "application/octet-stream"}
+        try:
+            request("PUT", f"{base}/session?id={sid}", body, headers)
+            return True
+        except (urllib.error.URLError, OSError):
+            return False
+
+    t0 = time.monotonic()
+    todo = list(range(session["chunks"]))
+    for attempt in range(args.attempts):
+        with ThreadPoolExecutor(args.parallel) as pool:
+            list(pool.map(put, todo))
+        # The gateway lists at most 64 missing chunks; loop until none are left
+        todo = request("GET", f"{base}/session")["missing"]
+        if not todo:
+            break
+        print(f"attempt {attempt + 1}: {len(todo)}+ chunks missing, resending")
+    else:
+        raise SystemExit("gave up: chunks still missing")
+
+    digest = hashlib.sha256(data).hexdigest()
+    result = request("POST", f"{base}/finalize?id={sid}&sha256={digest}")
+    elapsed = time.monotonic() - t0
+    print(f"staged {result['size']} bytes in {elapsed:.2f} s ({len(data) / 1024 / elapsed:.1f} KB/s)")
+
+
+if __name__ == "__main__":
+    main()
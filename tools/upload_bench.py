@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+"""Times hex uploads to the gateway and prints KB/s per body size.
+
+By default the bodies go to /api/upload?bench=1, which runs the real receive
+and decode path but does not keep the image, so 500 KB works on any build.
+Use --stage to time /api/upload itself (body must fit in RAM).
+
+    python3 tools/upload_bench.py --host 192.168.4.1 --runs 5
+"""
+import argparse
+import os
+import statistics
+import time
+import urllib.request
+
+
+def post(url, body):
+    req = urllib.request.Request(url, data=body, method="POST")
+    t0 = time.monotonic()
+    with urllib.request.urlopen(req, timeout=120) as resp:
+        resp.read()
+    return time.monotonic() - t0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--host", default="192.168.4.1")
+    ap.add_argument("--runs", type=int, default=5)
+    ap.add_argument("--sizes", default="50,100,500", help="body sizes in KB")
+    ap.add_argument("--stage", action="store_true", help="time /api/upload instead of the bench sink")
+    args = ap.parse_args()
+
+    url = f"http://{args.host}/api/upload" + ("" if args.stage else "?bench=1")
+    print(f"{'body KB':>8} {'median KB/s':>12} {'min KB/s':>10} {'max KB/s':>10}")
+    for kb in (int(s) for s in args.sizes.split(",")):
+        body = os.urandom(kb * 512).hex().encode()
+        rates = [kb / post(url, body) for _ in range(args.runs)]
+        print(f"{kb:>8} {statistics.median(rates):>12.1f} {min(rates):>10.1f} {max(rates):>10.1f}")
+
+
+if __name__ == "__main__":
+    main()